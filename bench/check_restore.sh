@@ -0,0 +1,45 @@
+#!/bin/sh
+# Checks that a run restored from a checkpoint continues exactly as if
+# it had never stopped: N steps straight must leave the same checkpoint,
+# byte for byte, as N/2 steps, a restore, and N/2 more.
+#
+# usage: bench/check_restore.sh [N-BODY BINARY]
+
+bin=${1:-$(dirname "$0")/../_bin/Debug/n-body_11_23}
+steps=40
+half=$((steps / 2))
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+if [ ! -x "$bin" ]; then
+  echo "check_restore: no n-body binary at $bin" >&2
+  exit 1
+fi
+
+failed=0
+check ()
+{
+  name=$1
+  shift
+  args="--headless --seed 7 --bodies 400 --threads 4 $*"
+  if ! "$bin" $args --steps $steps --checkpoint "$dir/straight.ckp" >/dev/null \
+     || ! "$bin" $args --steps $half --checkpoint "$dir/half.ckp" >/dev/null \
+     || ! "$bin" --headless --threads 4 --restore "$dir/half.ckp" \
+              --steps $half --checkpoint "$dir/restored.ckp" >/dev/null
+  then
+    echo "FAIL $name: run failed"
+    failed=1
+  elif cmp -s "$dir/straight.ckp" "$dir/restored.ckp"; then
+    echo "ok   $name"
+  else
+    echo "FAIL $name: checkpoints differ"
+    failed=1
+  fi
+}
+
+check "euler, barnes-hut, bounce" --ic plummer
+check "leapfrog, direct, bounce" --ic plummer --integrator leapfrog --solver direct
+check "yoshida, symmetric, none" --ic disk --integrator yoshida --solver symmetric --collisions none
+check "block, barnes-hut, merge" --ic plummer --integrator block --collisions merge
+check "block, direct, bounce" --ic uniform --integrator block --solver direct
+exit $failed
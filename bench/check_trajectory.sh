@@ -0,0 +1,109 @@
+#!/bin/sh
+# Checks that trajectory files decode to what the run computed: every
+# encoding must give back the same frames, bit for bit, and the last
+# frame must match the positions and velocities of the checkpoint
+# written at the end of the same run.  Needs python3 for the decoder.
+#
+# usage: bench/check_trajectory.sh [N-BODY BINARY]
+
+bin=${1:-$(dirname "$0")/../_bin/Debug/n-body_11_23}
+steps=40
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+if [ ! -x "$bin" ]; then
+  echo "check_trajectory: no n-body binary at $bin" >&2
+  exit 1
+fi
+
+failed=0
+check ()
+{
+  name=$1
+  every=$2
+  shift 2
+  for enc in raw delta deflate delta-deflate; do
+    if ! "$bin" --headless --seed 7 --bodies 400 --threads 4 --steps $steps \
+         --checkpoint "$dir/$enc.ckp" --trajectory "$dir/$enc.trj" \
+         --trajectory-every $every --trajectory-encoding $enc "$@" \
+         >/dev/null; then
+      echo "FAIL $name: $enc run failed"
+      failed=1
+      return
+    fi
+  done
+  if python3 - "$dir" $steps $every <<'EOF'
+import struct, sys, zlib
+
+def trajectory (path):
+    """Returns the frames of the trajectory at PATH as a list of
+    (step, time, fields), fields being the raw bits of every double."""
+    d = open (path, 'rb').read ()
+    magic, version, endian, field_cnt, chunk_frames, dt, seed = \
+        struct.unpack_from ('<8sIIIIdQ', d, 0)
+    assert magic == b'NBODYTRJ' and version == 1 and endian == 0x01020304
+    frames = []
+    o = 40
+    while o < len (d):
+        magic, frame_cnt, cnt, flags, _, raw_size, stored_size = \
+            struct.unpack_from ('<4sIQIIQQ', d, o)
+        assert magic == b'CHNK'
+        o += 40
+        infos = [struct.unpack_from ('<Qd', d, o + 16 * i)
+                 for i in range (frame_cnt)]
+        o += 16 * frame_cnt
+        payload = d[o:o + stored_size]
+        o += stored_size
+        if flags & 2:
+            payload = zlib.decompress (payload, -15)
+        assert len (payload) == raw_size
+        n = field_cnt * cnt
+        prev = None
+        for k, (step, time) in enumerate (infos):
+            frame = payload[k * 8 * n:(k + 1) * 8 * n]
+            vals = [int.from_bytes (bytes (frame[b * n + i] for b in range (8)),
+                                    'little') for i in range (n)]
+            if flags & 1 and k > 0:
+                vals = [v ^ p for v, p in zip (vals, prev)]
+            prev = vals
+            frames.append ((step, time, vals))
+    return frames
+
+def checkpoint (path):
+    """Returns the step count and the raw bits of the positions and
+    velocities of the checkpoint at PATH."""
+    d = open (path, 'rb').read ()
+    magic, version, endian, cnt, step_cnt = struct.unpack_from ('<8sIIQQ', d, 0)
+    assert magic == b'NBODYCKP' and endian == 0x01020304
+    offset = struct.unpack_from ('<12Q', d, 96)
+    vals = []
+    for f in range (4):         # pos_x, pos_y, vel_x, vel_y
+        vals += struct.unpack_from ('<%dQ' % cnt, d, offset[f])
+    return step_cnt, vals
+
+dir, steps, every = sys.argv[1], int (sys.argv[2]), int (sys.argv[3])
+raw = trajectory (dir + '/raw.trj')
+if [f[0] for f in raw] != list (range (0, steps + 1, every)):
+    sys.exit ('frames are not every %d steps from 0 to %d' % (every, steps))
+for enc in ('delta', 'deflate', 'delta-deflate'):
+    if trajectory ('%s/%s.trj' % (dir, enc)) != raw:
+        sys.exit ('%s frames differ from raw' % enc)
+    if open ('%s/%s.ckp' % (dir, enc), 'rb').read () \
+       != open (dir + '/raw.ckp', 'rb').read ():
+        sys.exit ('%s run differs from raw' % enc)
+step_cnt, vals = checkpoint (dir + '/raw.ckp')
+if step_cnt != raw[-1][0] or vals != raw[-1][2]:
+    sys.exit ('last frame differs from the checkpoint')
+EOF
+  then
+    echo "ok   $name"
+  else
+    echo "FAIL $name"
+    failed=1
+  fi
+}
+
+check "euler, bounce" 1 --ic plummer
+check "block, merge" 1 --ic plummer --integrator block --collisions merge
+check "leapfrog, every 4 steps" 4 --ic disk --integrator leapfrog
+exit $failed
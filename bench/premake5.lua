@@ -0,0 +1,30 @@
+
+baseName = path.getbasename(os.getcwd());
+
+-- Headless tools built on the physics core: every source of the
+-- game but its entry point, plus the tool's own driver.
+function core_tool(name)
+    project (name)
+        kind "ConsoleApp"
+        location "../_build"
+        targetdir "../_bin/%{cfg.buildcfg}"
+
+        vpaths
+        {
+          ["Header Files/*"] = { "../game/src/**.h"},
+          ["Source Files/*"] = { "src/" .. name .. ".c", "../game/src/**.c"},
+        }
+        files {"src/" .. name .. ".c", "../game/src/**.c", "../game/src/**.h"}
+        removefiles {"../game/src/main.c"}
+
+        includedirs { "src" }
+        includedirs { "../game/src" }
+
+        link_raylib()
+end
+
+-- Throughput benchmark
+core_tool("bench")
+
+-- Accuracy versus cost harness
+core_tool("accuracy")
@@ -0,0 +1,531 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "raylib.h"
+#include "sim.h"
+
+/* Accuracy Versus Cost Harness
+
+   Runs the same initial bodies through direct summation in double
+   precision, the exact path, and through each configuration of an
+   approximate solver, and reports what every configuration gives
+   up for its speed:
+
+   - Force error: per body |a - a_ref| / |a_ref| against the
+     reference accelerations, as RMS, 99th percentile and maximum,
+     on the initial bodies and on the reference's bodies after the
+     run, since clustered states are harder on tree codes.
+   - Energy and momentum drift over STEPS steps.  Collisions are
+     off, so only the solver and the integrator change either.
+     Forces fall off as 1 / |d| and the potential energy has no
+     natural zero, so the energy error is |E - E0| over the larger
+     of the initial and final kinetic energy; the momentum error is
+     |P - P0| over the sum of m |v| at the start.
+   - Wall time of one force evaluation and of the whole run.
+
+   Results go out as one JSON document, progress to stderr. */
+
+#define CONFIG_MAX 32         /* Configurations per run. */
+
+/* Force solver configuration. */
+struct config
+{
+  char name[32];              /* As given on the command line. */
+  enum force_solver solver;
+  enum gravity_precision precision;
+  double theta;               /* Barnes-Hut opening angle. */
+};
+
+/* Command Line Options */
+struct options
+{
+  size_t bodies;
+  enum ic_model ic;
+  uint64_t seed;
+  uint64_t steps;
+  double dt;
+  enum integrator integrator;
+  enum gravity_softening softening;
+  double eps;
+  int threads;                /* 0 for one per CPU. */
+  struct config configs[CONFIG_MAX];
+  int config_cnt;
+  const char *out;            /* Output file, or NULL for stdout. */
+};
+
+/* Conserved quantities of a body store. */
+struct totals
+{
+  double kinetic;
+  double potential;
+  double px, py;              /* Momentum. */
+  double p_scale;             /* Sum of m |v|. */
+};
+
+/* Relative force error over all bodies. */
+struct error_stats
+{
+  double rms;
+  double p99;
+  double max;
+};
+
+/* Measurements of one configuration. */
+struct outcome
+{
+  double force_seconds;       /* One force evaluation. */
+  double run_seconds;         /* All steps. */
+  double energy_error;
+  double momentum_error;
+  struct error_stats initial; /* Force error on the initial bodies. */
+  struct error_stats final;   /* On the reference's final bodies. */
+};
+
+/* Potential energy job shared by the workers. */
+struct energy_job
+{
+  const struct body_store *bodies;
+  const struct gravity_ctx *ctx;      /* Softening. */
+  double partial[THREAD_POOL_MAX];    /* Per worker. */
+};
+
+/* Static Functions */
+static bool parse_options (int argc, char **argv, struct options *opts);
+static void usage (const char *prog);
+static bool parse_configs (const char *s, struct options *opts);
+static void configure (struct sim *sim, const struct options *opts,
+                       const struct config *cfg);
+static void clone_bodies (struct body_store *dst,
+                          const struct body_store *src);
+static double time_forces (struct sim *sim);
+static void run_steps (struct sim *sim, const struct options *opts,
+                       struct outcome *out);
+static void force_error (const struct body_store *b, const double *ref_x,
+                         const double *ref_y, struct error_stats *e);
+static int compare_doubles (const void *a_, const void *b_);
+static void totals (struct sim *sim, struct totals *t);
+static void energy_task (void *job_, size_t begin, size_t end, int worker);
+static double *copy_array (const double *src, size_t cnt);
+static void print_outcome (FILE *f, const char *name, const struct config *cfg,
+                           const struct outcome *o, double ref_force_seconds,
+                           bool first);
+
+int main (int argc, char **argv)
+{
+  struct options opts;
+  if (!parse_options (argc, argv, &opts))
+  {
+    usage (argv[0]);
+    return 1;
+  }
+  SetTraceLogLevel (LOG_WARNING);
+
+  FILE *f = stdout;
+  if (opts.out != NULL && (f = fopen (opts.out, "w")) == NULL)
+  {
+    fprintf (stderr, "accuracy: cannot open %s\n", opts.out);
+    return 1;
+  }
+
+  /* Reference: direct summation in double precision */
+  struct config exact = {"direct", SOLVER_DIRECT, GRAVITY_DOUBLE, 0};
+  struct sim ref;
+  sim_init (&ref, opts.bodies, opts.ic, opts.dt, opts.seed, opts.threads);
+  configure (&ref, &opts, &exact);
+  struct body_store initial;
+  clone_bodies (&initial, &ref.bodies);
+
+  fprintf (stderr, "accuracy: reference, %zu bodies, %llu steps\n",
+           opts.bodies, (unsigned long long) opts.steps);
+  struct outcome ref_out;
+  memset (&ref_out, 0, sizeof ref_out);
+  ref_out.force_seconds = time_forces (&ref);
+  double *ref_init_x = copy_array (ref.bodies.acc_x, opts.bodies);
+  double *ref_init_y = copy_array (ref.bodies.acc_y, opts.bodies);
+  run_steps (&ref, &opts, &ref_out);
+
+  /* The reference's bodies after the run, and their forces */
+  struct body_store final;
+  clone_bodies (&final, &ref.bodies);
+  sim_forces (&ref);
+  double *ref_final_x = copy_array (ref.bodies.acc_x, ref.bodies.cnt);
+  double *ref_final_y = copy_array (ref.bodies.acc_y, ref.bodies.cnt);
+  sim_destroy (&ref);
+
+  fprintf (f, "{\n  \"harness\": \"accuracy\",\n  \"version\": 1,\n");
+  fprintf (f, "  \"bodies\": %zu,\n  \"ic\": \"%s\",\n  \"seed\": %llu,\n",
+           opts.bodies, ic_model_name (opts.ic),
+           (unsigned long long) opts.seed);
+  fprintf (f, "  \"steps\": %llu,\n  \"dt\": %g,\n  \"integrator\": \"%s\",\n",
+           (unsigned long long) opts.steps, opts.dt,
+           sim_integrator_name (opts.integrator));
+  fprintf (f, "  \"softening\": \"%s\",\n  \"eps\": %g,\n  \"isa\": \"%s\",\n",
+           gravity_softening_name (opts.softening), opts.eps,
+           gravity_isa_name (gravity_get_isa ()));
+  fprintf (f, "  \"reference\":");
+  print_outcome (f, NULL, &exact, &ref_out, ref_out.force_seconds, true);
+  fprintf (f, ",\n  \"results\": [");
+
+  for (int c = 0; c < opts.config_cnt; c++)
+  {
+    const struct config *cfg = &opts.configs[c];
+    fprintf (stderr, "accuracy: %s\n", cfg->name);
+
+    struct sim sim;
+    struct body_store store;
+    sim_init (&sim, 0, opts.ic, opts.dt, opts.seed, opts.threads);
+    clone_bodies (&store, &initial);
+    sim_set_bodies (&sim, &store);
+    configure (&sim, &opts, cfg);
+
+    struct outcome out;
+    out.force_seconds = time_forces (&sim);
+    force_error (&sim.bodies, ref_init_x, ref_init_y, &out.initial);
+    run_steps (&sim, &opts, &out);
+
+    clone_bodies (&store, &final);
+    sim_set_bodies (&sim, &store);
+    sim_forces (&sim);
+    force_error (&sim.bodies, ref_final_x, ref_final_y, &out.final);
+    sim_destroy (&sim);
+
+    print_outcome (f, cfg->name, cfg, &out, ref_out.force_seconds, c == 0);
+  }
+  fprintf (f, "\n  ]\n}\n");
+
+  body_store_destroy (&initial);
+  body_store_destroy (&final);
+  free (ref_init_x);
+  free (ref_init_y);
+  free (ref_final_x);
+  free (ref_final_y);
+  if (f != stdout && fclose (f) != 0)
+  {
+    fprintf (stderr, "accuracy: cannot write %s\n", opts.out);
+    return 1;
+  }
+  return 0;
+}
+
+/* Parses the command line ARGV into OPTS.  Returns false on a bad
+   option. */
+static bool parse_options (int argc, char **argv, struct options *opts)
+{
+  opts->bodies = 4096;
+  opts->ic = IC_PLUMMER;
+  opts->seed = 1;
+  opts->steps = 200;
+  opts->dt = .1;
+  opts->integrator = INTEGRATOR_LEAPFROG;
+  opts->softening = GRAVITY_SOFT_SPLINE;
+  opts->eps = SIM_DEFAULT_EPS;
+  opts->threads = 0;
+  opts->out = NULL;
+  parse_configs ("barnes-hut@0.3,barnes-hut@0.5,barnes-hut@0.7,"
+                 "barnes-hut@1.0,direct-f32,symmetric", opts);
+
+  for (int i = 1; i < argc; i++)
+  {
+    const char *arg = argv[i];
+    const char *val = (i + 1 < argc) ? argv[i + 1] : NULL;
+    if (val == NULL)
+      return false;
+    i++;
+
+    if (strcmp (arg, "--bodies") == 0) opts->bodies = strtoull (val, NULL, 10);
+    else if (strcmp (arg, "--seed") == 0) opts->seed = strtoull (val, NULL, 10);
+    else if (strcmp (arg, "--steps") == 0) opts->steps = strtoull (val, NULL, 10);
+    else if (strcmp (arg, "--dt") == 0) opts->dt = strtod (val, NULL);
+    else if (strcmp (arg, "--eps") == 0) opts->eps = strtod (val, NULL);
+    else if (strcmp (arg, "--threads") == 0) opts->threads = atoi (val);
+    else if (strcmp (arg, "--out") == 0) opts->out = val;
+    else if (strcmp (arg, "--configs") == 0)
+    {
+      if (!parse_configs (val, opts))
+        return false;
+    }
+    else if (strcmp (arg, "--ic") == 0)
+    {
+      opts->ic = ic_model_by_name (val);
+      if (opts->ic == IC_CNT)
+        return false;
+    }
+    else if (strcmp (arg, "--integrator") == 0)
+    {
+      opts->integrator = sim_integrator_by_name (val);
+      if (opts->integrator == INTEGRATOR_CNT)
+        return false;
+    }
+    else if (strcmp (arg, "--softening") == 0)
+    {
+      opts->softening = sim_softening_by_name (val);
+      if (opts->softening == GRAVITY_SOFT_CNT)
+        return false;
+    }
+    else
+      return false;
+  }
+  return opts->bodies > 1 && opts->dt > 0;
+}
+
+/* Prints the command line help */
+static void usage (const char *prog)
+{
+  fprintf (stderr,
+           "usage: %s [options]\n"
+           "  --configs C,...         configurations to compare with direct\n"
+           "                          summation: barnes-hut[@THETA], direct,\n"
+           "                          direct-f32 or symmetric (barnes-hut at\n"
+           "                          0.3, 0.5, 0.7 and 1.0, direct-f32, symmetric)\n"
+           "  --bodies N              number of bodies (4096)\n"
+           "  --ic uniform|plummer|disk|collapse|lattice|galaxies\n"
+           "                          initial conditions (plummer)\n"
+           "  --seed N                random seed (1)\n"
+           "  --steps N               steps of the drift runs (200)\n"
+           "  --dt X                  time step (0.1)\n"
+           "  --integrator euler|leapfrog|verlet|yoshida|block\n"
+           "                          time integrator (leapfrog)\n"
+           "  --softening none|plummer|spline\n"
+           "                          softening law (spline)\n"
+           "  --eps X                 softening length (10)\n"
+           "  --threads N             worker threads (one per CPU)\n"
+           "  --out PATH              write the JSON report to PATH (stdout)\n",
+           prog);
+}
+
+/* Parses the comma separated configurations S into OPTS. */
+static bool parse_configs (const char *s, struct options *opts)
+{
+  char buf[512];
+  if (strlen (s) >= sizeof buf)
+    return false;
+  strcpy (buf, s);
+
+  opts->config_cnt = 0;
+  for (char *name = strtok (buf, ","); name != NULL; name = strtok (NULL, ","))
+  {
+    if (opts->config_cnt == CONFIG_MAX
+        || strlen (name) >= sizeof opts->configs[0].name)
+      return false;
+    struct config *cfg = &opts->configs[opts->config_cnt++];
+    strcpy (cfg->name, name);
+    cfg->precision = GRAVITY_DOUBLE;
+    cfg->theta = QT_DEFAULT_THETA;
+
+    char *at = strchr (name, '@');
+    if (at != NULL)
+    {
+      char *end;
+      *at = '\0';
+      cfg->theta = strtod (at + 1, &end);
+      if (end == at + 1 || *end != '\0' || cfg->theta < 0)
+        return false;
+    }
+    if (strcmp (name, "direct-f32") == 0)
+    {
+      cfg->solver = SOLVER_DIRECT;
+      cfg->precision = GRAVITY_FLOAT;
+    }
+    else
+      cfg->solver = sim_solver_by_name (name);
+    if (cfg->solver == SOLVER_CNT
+        || (at != NULL && cfg->solver != SOLVER_BARNES_HUT))
+      return false;
+  }
+  return opts->config_cnt > 0;
+}
+
+/* Sets up SIM for the runs of OPTS with the solver of CFG */
+static void configure (struct sim *sim, const struct options *opts,
+                       const struct config *cfg)
+{
+  sim->solver = cfg->solver;
+  sim->direct.precision = cfg->precision;
+  sim->tree.theta = cfg->theta;
+  sim->integrator = opts->integrator;
+  sim->collisions = COLLISION_NONE;
+  sim_set_softening (sim, opts->softening, opts->eps);
+}
+
+/* Initializes DST with a copy of the bodies of SRC */
+static void clone_bodies (struct body_store *dst,
+                          const struct body_store *src)
+{
+  body_store_init (dst, src->cnt);
+#define COPY(F) memcpy (dst->F, src->F, src->cnt * sizeof *src->F);
+  BODY_ARRAYS (COPY)
+#undef COPY
+}
+
+/* Evaluates the accelerations of SIM and returns the wall time it
+   took */
+static double time_forces (struct sim *sim)
+{
+  double start = sim_clock ();
+  sim_forces (sim);
+  return sim_clock () - start;
+}
+
+/* Runs the steps of OPTS on SIM and measures their wall time and
+   drift into OUT */
+static void run_steps (struct sim *sim, const struct options *opts,
+                       struct outcome *out)
+{
+  struct totals t0, t1;
+  totals (sim, &t0);
+  double start = sim_clock ();
+  for (uint64_t s = 0; s < opts->steps; s++)
+    sim_step (sim);
+  out->run_seconds = sim_clock () - start;
+  totals (sim, &t1);
+
+  double e0 = t0.kinetic + t0.potential;
+  double e1 = t1.kinetic + t1.potential;
+  double k = fmax (t0.kinetic, t1.kinetic);
+  out->energy_error = (k > 0) ? fabs (e1 - e0) / k : 0;
+  out->momentum_error = (t0.p_scale > 0)
+                        ? hypot (t1.px - t0.px, t1.py - t0.py) / t0.p_scale
+                        : 0;
+}
+
+/* Computes the relative error of the accelerations of B against
+   REF_X, REF_Y into *E.  Bodies with no reference force are left
+   out. */
+static void force_error (const struct body_store *b, const double *ref_x,
+                         const double *ref_y, struct error_stats *e)
+{
+  double *err = malloc ((b->cnt ? b->cnt : 1) * sizeof *err);
+  if (err == NULL)
+  {
+    fprintf (stderr, "accuracy: out of memory\n");
+    exit (1);
+  }
+
+  size_t n = 0;
+  double sum2 = 0;
+  for (size_t i = 0; i < b->cnt; i++)
+  {
+    double ref = hypot (ref_x[i], ref_y[i]);
+    if (ref == 0)
+      continue;
+    err[n] = hypot (b->acc_x[i] - ref_x[i], b->acc_y[i] - ref_y[i]) / ref;
+    sum2 += err[n] * err[n];
+    n++;
+  }
+
+  memset (e, 0, sizeof *e);
+  if (n > 0)
+  {
+    qsort (err, n, sizeof *err, compare_doubles);
+    e->rms = sqrt (sum2 / n);
+    e->p99 = err[(size_t) ceil (.99 * n) - 1];
+    e->max = err[n - 1];
+  }
+  free (err);
+}
+
+/* qsort() comparison of two doubles */
+static int compare_doubles (const void *a_, const void *b_)
+{
+  double a = *(const double *) a_;
+  double b = *(const double *) b_;
+  return (a > b) - (a < b);
+}
+
+/* Adds up the energy and momentum of the bodies of SIM into *T.
+   The potential energy is an all-pairs sum on SIM's threads. */
+static void totals (struct sim *sim, struct totals *t)
+{
+  const struct body_store *b = &sim->bodies;
+  memset (t, 0, sizeof *t);
+  for (size_t i = 0; i < b->cnt; i++)
+  {
+    double v2 = b->vel_x[i] * b->vel_x[i] + b->vel_y[i] * b->vel_y[i];
+    t->kinetic += .5 * b->mass[i] * v2;
+    t->px += b->mass[i] * b->vel_x[i];
+    t->py += b->mass[i] * b->vel_y[i];
+    t->p_scale += b->mass[i] * sqrt (v2);
+  }
+
+  struct energy_job job = {b, &sim->direct, {0}};
+  thread_pool_run (&sim->pool, b->cnt, energy_task, &job);
+  for (int w = 0; w < sim->pool.thread_cnt; w++)
+    t->potential += job.partial[w];
+}
+
+/* Adds the potential energy of bodies BEGIN..END of JOB_ against
+   all others, half of every pair, to the worker's partial sum */
+static void energy_task (void *job_, size_t begin, size_t end, int worker)
+{
+  struct energy_job *job = job_;
+  const struct body_store *b = job->bodies;
+  const struct gravity_ctx *ctx = job->ctx;
+  double sum = 0;
+
+  for (size_t i = begin; i < end; i++)
+  {
+    double row = 0;
+    for (size_t j = 0; j < b->cnt; j++)
+    {
+      if (j == i)
+        continue;
+      double dx = b->pos_x[j] - b->pos_x[i];
+      double dy = b->pos_y[j] - b->pos_y[i];
+      row += b->mass[j] * gravity_soft_potential (ctx->softening,
+                                                  dx * dx + dy * dy,
+                                                  ctx->eps2, ctx->inv_eps4);
+    }
+    sum += .5 * b->mass[i] * row;
+  }
+  job->partial[worker] = sum;
+}
+
+/* Returns a heap copy of the CNT doubles at SRC, exiting on
+   failure */
+static double *copy_array (const double *src, size_t cnt)
+{
+  double *p = malloc ((cnt ? cnt : 1) * sizeof *p);
+  if (p == NULL)
+  {
+    fprintf (stderr, "accuracy: out of memory\n");
+    exit (1);
+  }
+  memcpy (p, src, cnt * sizeof *p);
+  return p;
+}
+
+/* Writes O, measured with CFG, to F: as the reference object if
+   NAME is NULL, else as an element of the results array */
+static void print_outcome (FILE *f, const char *name, const struct config *cfg,
+                           const struct outcome *o, double ref_force_seconds,
+                           bool first)
+{
+  const char *indent = (name != NULL) ? "      " : "    ";
+  if (name != NULL)
+    fprintf (f, "%s\n    {\n%s\"config\": \"%s\",\n", first ? "" : ",",
+             indent, name);
+  else
+    fprintf (f, " {\n");
+
+  fprintf (f, "%s\"solver\": \"%s\",\n%s\"precision\": \"%s\",\n", indent,
+           sim_solver_name (cfg->solver), indent,
+           cfg->precision == GRAVITY_FLOAT ? "f32" : "f64");
+  if (cfg->solver == SOLVER_BARNES_HUT)
+    fprintf (f, "%s\"theta\": %g,\n", indent, cfg->theta);
+  if (name != NULL)
+    fprintf (f, "%s\"force_error\": {\n"
+             "%s  \"initial\": {\"rms\": %.6g, \"p99\": %.6g, \"max\": %.6g},\n"
+             "%s  \"final\": {\"rms\": %.6g, \"p99\": %.6g, \"max\": %.6g}\n"
+             "%s},\n", indent,
+             indent, o->initial.rms, o->initial.p99, o->initial.max,
+             indent, o->final.rms, o->final.p99, o->final.max, indent);
+  fprintf (f, "%s\"force_seconds\": %.6g,\n", indent, o->force_seconds);
+  if (name != NULL)
+    fprintf (f, "%s\"force_speedup\": %.6g,\n", indent,
+             (o->force_seconds > 0) ? ref_force_seconds / o->force_seconds : 0);
+  fprintf (f, "%s\"run_seconds\": %.6g,\n%s\"energy_error\": %.6g,\n"
+           "%s\"momentum_error\": %.6g\n%s}", indent, o->run_seconds, indent,
+           o->energy_error, indent, o->momentum_error,
+           (name != NULL) ? "    " : "  ");
+}
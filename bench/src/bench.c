@@ -0,0 +1,422 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include "raylib.h"
+#include "sim.h"
+
+/* Physics Core Benchmark
+
+   Runs the simulation core without a window over a sweep of body
+   counts, thread counts and force solvers.  For every combination
+   the three phases of a step (force evaluation, collision handling
+   and the kick and drift passes) are timed apart, then whole steps
+   are timed.  Each measurement repeats its phase until at least
+   MIN_TIME seconds have passed, so small and large runs are equally
+   reliable.  Results go out as one JSON document, progress to
+   stderr, so two builds can be compared with any JSON tool. */
+
+#define LIST_MAX 16           /* Values per sweep axis. */
+
+/* Command Line Options */
+struct options
+{
+  size_t counts[LIST_MAX];    /* Body counts. */
+  int count_cnt;
+  int threads[LIST_MAX];      /* Thread counts, 0 for one per CPU. */
+  int thread_cnt;
+  enum force_solver solvers[LIST_MAX];
+  int solver_cnt;
+  enum integrator integrator;
+  enum ic_model ic;
+  double dt;
+  uint64_t seed;
+  double min_time;            /* Seconds per measurement. */
+  size_t direct_max;          /* Largest N for the O(N²) solvers. */
+  const char *out;            /* Output file, or NULL for stdout. */
+};
+
+/* Timing of one phase. */
+struct phase
+{
+  uint64_t calls;
+  double seconds;
+};
+
+/* Results of one combination of the sweep. */
+struct result
+{
+  size_t cnt;
+  int threads;
+  enum force_solver solver;
+  struct phase force;
+  uint64_t interactions;      /* Per force evaluation. */
+  struct phase collide;
+  size_t candidates;          /* Of the last collision pass. */
+  size_t contacts;
+  struct phase integrate;
+  struct phase step;
+  uint64_t step_interactions; /* Over all timed steps. */
+  size_t state_bytes;         /* Body arrays. */
+  size_t rss_bytes;           /* Resident set while the sim lived. */
+};
+
+/* Static Functions */
+static bool parse_options (int argc, char **argv, struct options *opts);
+static void usage (const char *prog);
+static bool parse_counts (const char *s, struct options *opts);
+static bool parse_threads (const char *s, struct options *opts);
+static bool parse_solvers (const char *s, struct options *opts);
+static void run (const struct options *opts, size_t cnt, int threads,
+                 enum force_solver solver, struct result *r);
+static size_t resident_bytes (void);
+static void print_result (FILE *f, const struct options *opts,
+                          const struct result *r);
+static void print_phase (FILE *f, const char *name, const struct phase *p,
+                         double per, const char *per_name);
+
+int main (int argc, char **argv)
+{
+  struct options opts;
+  if (!parse_options (argc, argv, &opts))
+  {
+    usage (argv[0]);
+    return 1;
+  }
+  SetTraceLogLevel (LOG_WARNING);
+  gravity_init ();
+
+  FILE *f = stdout;
+  if (opts.out != NULL && (f = fopen (opts.out, "w")) == NULL)
+  {
+    fprintf (stderr, "bench: cannot open %s\n", opts.out);
+    return 1;
+  }
+
+  int cpus = thread_pool_default_size ();
+  fprintf (f, "{\n  \"benchmark\": \"n-body\",\n  \"version\": 1,\n");
+  fprintf (f, "  \"cpus\": %d,\n  \"isa\": \"%s\",\n", cpus,
+           gravity_isa_name (gravity_get_isa ()));
+  fprintf (f, "  \"integrator\": \"%s\",\n  \"ic\": \"%s\",\n",
+           sim_integrator_name (opts.integrator), ic_model_name (opts.ic));
+  fprintf (f, "  \"dt\": %g,\n  \"seed\": %llu,\n  \"min_time\": %g,\n",
+           opts.dt, (unsigned long long) opts.seed, opts.min_time);
+  fprintf (f, "  \"results\": [");
+
+  /* Thread counts that come out the same are run once, and runs
+     too slow to be worth timing are left out of the sweep */
+  bool first = true;
+  for (int c = 0; c < opts.count_cnt; c++)
+    for (int s = 0; s < opts.solver_cnt; s++)
+      for (int t = 0; t < opts.thread_cnt; t++)
+      {
+        size_t cnt = opts.counts[c];
+        enum force_solver solver = opts.solvers[s];
+        int threads = opts.threads[t] > 0 ? opts.threads[t] : cpus;
+        bool seen = false;
+        for (int u = 0; u < t; u++)
+          seen |= (opts.threads[u] > 0 ? opts.threads[u] : cpus) == threads;
+        if (seen)
+          continue;
+        if (solver != SOLVER_BARNES_HUT && cnt > opts.direct_max)
+        {
+          fprintf (stderr, "bench: skipping %s with %zu bodies "
+                   "(--direct-max %zu)\n", sim_solver_name (solver), cnt,
+                   opts.direct_max);
+          continue;
+        }
+
+        fprintf (stderr, "bench: %zu bodies, %s, %d threads\n", cnt,
+                 sim_solver_name (solver), threads);
+        struct result r;
+        run (&opts, cnt, threads, solver, &r);
+        if (!first)
+          fprintf (f, ",");
+        print_result (f, &opts, &r);
+        first = false;
+      }
+
+  fprintf (f, "\n  ]\n}\n");
+  if (f != stdout && fclose (f) != 0)
+  {
+    fprintf (stderr, "bench: cannot write %s\n", opts.out);
+    return 1;
+  }
+  return 0;
+}
+
+/* Parses the command line ARGV into OPTS.  Returns false on a bad
+   option. */
+static bool parse_options (int argc, char **argv, struct options *opts)
+{
+  parse_counts ("1000,10000,100000,1000000", opts);
+  parse_threads ("1,0", opts);
+  parse_solvers ("direct,barnes-hut,symmetric", opts);
+  opts->integrator = INTEGRATOR_LEAPFROG;
+  opts->ic = IC_PLUMMER;
+  opts->dt = .1;
+  opts->seed = 1;
+  opts->min_time = .5;
+  opts->direct_max = 32768;
+  opts->out = NULL;
+
+  for (int i = 1; i < argc; i++)
+  {
+    const char *arg = argv[i];
+    const char *val = (i + 1 < argc) ? argv[i + 1] : NULL;
+    if (val == NULL)
+      return false;
+    i++;
+
+    if (strcmp (arg, "--bodies") == 0)
+    {
+      if (!parse_counts (val, opts))
+        return false;
+    }
+    else if (strcmp (arg, "--threads") == 0)
+    {
+      if (!parse_threads (val, opts))
+        return false;
+    }
+    else if (strcmp (arg, "--solvers") == 0)
+    {
+      if (!parse_solvers (val, opts))
+        return false;
+    }
+    else if (strcmp (arg, "--integrator") == 0)
+    {
+      opts->integrator = sim_integrator_by_name (val);
+      if (opts->integrator == INTEGRATOR_CNT)
+        return false;
+    }
+    else if (strcmp (arg, "--ic") == 0)
+    {
+      opts->ic = ic_model_by_name (val);
+      if (opts->ic == IC_CNT)
+        return false;
+    }
+    else if (strcmp (arg, "--dt") == 0) opts->dt = strtod (val, NULL);
+    else if (strcmp (arg, "--seed") == 0) opts->seed = strtoull (val, NULL, 10);
+    else if (strcmp (arg, "--min-time") == 0) opts->min_time = strtod (val, NULL);
+    else if (strcmp (arg, "--direct-max") == 0) opts->direct_max = strtoull (val, NULL, 10);
+    else if (strcmp (arg, "--out") == 0) opts->out = val;
+    else
+      return false;
+  }
+  return opts->dt > 0 && opts->min_time >= 0;
+}
+
+/* Prints the command line help */
+static void usage (const char *prog)
+{
+  fprintf (stderr,
+           "usage: %s [options]\n"
+           "  --bodies N,...          body counts (1000,10000,100000,1000000)\n"
+           "  --threads N,...         thread counts, 0 for one per CPU (1,0)\n"
+           "  --solvers S,...         force solvers among direct, barnes-hut\n"
+           "                          and symmetric (all)\n"
+           "  --integrator euler|leapfrog|verlet|yoshida|block\n"
+           "                          time integrator for whole steps (leapfrog)\n"
+           "  --ic uniform|plummer|disk|collapse|lattice|galaxies\n"
+           "                          initial conditions (plummer)\n"
+           "  --dt X                  time step (0.1)\n"
+           "  --seed N                random seed (1)\n"
+           "  --min-time X            seconds per measurement (0.5)\n"
+           "  --direct-max N          largest N for direct and symmetric (32768)\n"
+           "  --out PATH              write the JSON report to PATH (stdout)\n",
+           prog);
+}
+
+/* Parses the comma separated body counts S into OPTS. */
+static bool parse_counts (const char *s, struct options *opts)
+{
+  opts->count_cnt = 0;
+  for (const char *p = s; ; p++)
+  {
+    char *end;
+    unsigned long long v = strtoull (p, &end, 10);
+    if (end == p || v == 0 || opts->count_cnt == LIST_MAX)
+      return false;
+    opts->counts[opts->count_cnt++] = v;
+    if (*end == '\0')
+      return true;
+    if (*end != ',')
+      return false;
+    p = end;
+  }
+}
+
+/* Parses the comma separated thread counts S into OPTS. */
+static bool parse_threads (const char *s, struct options *opts)
+{
+  opts->thread_cnt = 0;
+  for (const char *p = s; ; p++)
+  {
+    char *end;
+    long v = strtol (p, &end, 10);
+    if (end == p || v < 0 || v > THREAD_POOL_MAX
+        || opts->thread_cnt == LIST_MAX)
+      return false;
+    opts->threads[opts->thread_cnt++] = v;
+    if (*end == '\0')
+      return true;
+    if (*end != ',')
+      return false;
+    p = end;
+  }
+}
+
+/* Parses the comma separated solver names S into OPTS. */
+static bool parse_solvers (const char *s, struct options *opts)
+{
+  char buf[256];
+  if (strlen (s) >= sizeof buf)
+    return false;
+  strcpy (buf, s);
+
+  opts->solver_cnt = 0;
+  for (char *name = strtok (buf, ","); name != NULL; name = strtok (NULL, ","))
+  {
+    enum force_solver solver = sim_solver_by_name (name);
+    if (solver == SOLVER_CNT || opts->solver_cnt == LIST_MAX)
+      return false;
+    opts->solvers[opts->solver_cnt++] = solver;
+  }
+  return opts->solver_cnt > 0;
+}
+
+/* Times each phase of a step and whole steps of a sim of CNT bodies
+   on THREADS threads with SOLVER, into R */
+static void run (const struct options *opts, size_t cnt, int threads,
+                 enum force_solver solver, struct result *r)
+{
+  struct sim sim;
+  sim_init (&sim, cnt, opts->ic, opts->dt, opts->seed, threads);
+  sim.solver = solver;
+  sim.integrator = opts->integrator;
+
+  memset (r, 0, sizeof *r);
+  r->cnt = cnt;
+  r->threads = sim.pool.thread_cnt;
+  r->solver = solver;
+
+  /* One step first, so every buffer has grown to size */
+  sim_step (&sim);
+
+  double start = sim_clock ();
+  do
+  {
+    sim_forces (&sim);
+    r->force.calls++;
+  }
+  while ((r->force.seconds = sim_clock () - start) < opts->min_time);
+  r->interactions = sim.stats.interactions;
+
+  start = sim_clock ();
+  do
+  {
+    sim_collide (&sim);
+    r->collide.calls++;
+  }
+  while ((r->collide.seconds = sim_clock () - start) < opts->min_time);
+  r->candidates = sim.stats.candidates;
+  r->contacts = sim.stats.contacts;
+
+  start = sim_clock ();
+  do
+  {
+    sim_kick_drift (&sim, opts->dt);
+    r->integrate.calls++;
+  }
+  while ((r->integrate.seconds = sim_clock () - start) < opts->min_time);
+
+  start = sim_clock ();
+  do
+  {
+    sim_step (&sim);
+    r->step.calls++;
+    r->step_interactions += sim.stats.interactions;
+  }
+  while ((r->step.seconds = sim_clock () - start) < opts->min_time);
+
+  const struct body_store *b = &sim.bodies;
+  size_t per_body = 0;
+#define SIZE(F) per_body += sizeof *b->F;
+  BODY_ARRAYS (SIZE)
+#undef SIZE
+  r->state_bytes = b->cap * (per_body + sizeof *b->handle);
+  r->rss_bytes = resident_bytes ();
+  sim_destroy (&sim);
+}
+
+/* Returns the resident set size of the process in bytes, or 0 if it
+   cannot be read */
+static size_t resident_bytes (void)
+{
+  FILE *f = fopen ("/proc/self/statm", "r");
+  unsigned long size, resident;
+  bool ok = f != NULL && fscanf (f, "%lu %lu", &size, &resident) == 2;
+  if (f != NULL)
+    fclose (f);
+  if (ok)
+    return (size_t) resident * sysconf (_SC_PAGESIZE);
+
+  /* Fall back to the peak, which is all getrusage() knows */
+  struct rusage ru;
+  if (getrusage (RUSAGE_SELF, &ru) != 0)
+    return 0;
+  return (size_t) ru.ru_maxrss * 1024;
+}
+
+/* Writes R to F as one element of the results array */
+static void print_result (FILE *f, const struct options *opts,
+                          const struct result *r)
+{
+  fprintf (f, "\n    {\n");
+  fprintf (f, "      \"bodies\": %zu,\n      \"threads\": %d,\n"
+           "      \"solver\": \"%s\",\n", r->cnt, r->threads,
+           sim_solver_name (r->solver));
+
+  double force = r->force.seconds / r->force.calls;
+  print_phase (f, "force", &r->force,
+               r->interactions ? force * 1e9 / r->interactions : 0,
+               "ns_per_interaction");
+  fprintf (f, "        \"interactions\": %llu\n      },\n",
+           (unsigned long long) r->interactions);
+
+  double collide = r->collide.seconds / r->collide.calls;
+  print_phase (f, "collision", &r->collide, collide * 1e9 / r->cnt,
+               "ns_per_body");
+  fprintf (f, "        \"candidates\": %zu,\n        \"contacts\": %zu\n"
+           "      },\n", r->candidates, r->contacts);
+
+  double integrate = r->integrate.seconds / r->integrate.calls;
+  print_phase (f, "integration", &r->integrate, integrate * 1e9 / r->cnt,
+               "ns_per_body");
+  fprintf (f, "        \"kernel\": \"kick-drift\"\n      },\n");
+
+  print_phase (f, "step", &r->step,
+               r->step_interactions ? r->step.seconds * 1e9
+                                      / r->step_interactions : 0,
+               "ns_per_interaction");
+  fprintf (f, "        \"steps_per_second\": %.6g,\n"
+           "        \"integrator\": \"%s\"\n      },\n",
+           r->step.calls / r->step.seconds,
+           sim_integrator_name (opts->integrator));
+
+  fprintf (f, "      \"memory\": {\n        \"state_bytes\": %zu,\n"
+           "        \"rss_bytes\": %zu\n      }\n    }", r->state_bytes,
+           r->rss_bytes);
+}
+
+/* Writes the opening of the phase object NAME for P to F, with PER
+   under PER_NAME; the caller adds the rest and closes it */
+static void print_phase (FILE *f, const char *name, const struct phase *p,
+                         double per, const char *per_name)
+{
+  fprintf (f, "      \"%s\": {\n        \"calls\": %llu,\n"
+           "        \"seconds\": %.6g,\n        \"seconds_per_call\": %.6g,\n"
+           "        \"%s\": %.6g,\n", name, (unsigned long long) p->calls,
+           p->seconds, p->seconds / p->calls, per_name, per);
+}
@@ -0,0 +1,232 @@
+#include "body.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+static void *alloc_array (size_t cnt, size_t size);
+static void *move_array (void *old, size_t used, size_t cnt, size_t size,
+                         bool owned);
+static void handles_init (struct body_store *store, size_t cnt);
+static uint32_t slot_alloc (struct body_store *store);
+static void slot_free (struct body_store *store, uint32_t slot);
+
+/* Allocates a zeroed array of CNT elements of SIZE bytes on a
+   BODY_ALIGN boundary, exiting on failure. */
+static void *alloc_array (size_t cnt, size_t size)
+{
+  size_t bytes = (cnt ? cnt : 1) * size;
+  bytes = (bytes + BODY_ALIGN - 1) / BODY_ALIGN * BODY_ALIGN;
+  void *p;
+  if (posix_memalign (&p, BODY_ALIGN, bytes) != 0)
+    {
+      fprintf (stderr, "body_store: out of memory\n");
+      exit (1);
+    }
+  memset (p, 0, bytes);
+  return p;
+}
+
+/* Returns a new array of CNT elements of SIZE bytes holding the
+   first USED elements of OLD, and frees OLD if OWNED. */
+static void *move_array (void *old, size_t used, size_t cnt, size_t size,
+                         bool owned)
+{
+  void *p = alloc_array (cnt, size);
+  memcpy (p, old, used * size);
+  if (owned)
+    free (old);
+  return p;
+}
+
+/* Initializes STORE with room for CNT zeroed bodies. */
+void body_store_init (struct body_store *store, size_t cnt)
+{
+  assert (store != NULL);
+  store->cnt = cnt;
+  store->cap = cnt;
+#define ALLOC(F) store->F = alloc_array (cnt, sizeof *store->F);
+  BODY_ARRAYS (ALLOC)
+#undef ALLOC
+  store->map = NULL;
+  store->map_size = 0;
+  handles_init (store, cnt);
+}
+
+/* Initializes STORE for CNT bodies whose data arrays the caller
+   points into MAP, a mapping of MAP_SIZE bytes that STORE takes
+   over. */
+void body_store_init_mapped (struct body_store *store, size_t cnt, void *map,
+                             size_t map_size)
+{
+  assert (store != NULL && map != NULL);
+  store->cnt = cnt;
+  store->cap = cnt;
+  store->map = map;
+  store->map_size = map_size;
+  handles_init (store, cnt);
+}
+
+/* Frees the arrays held by STORE. */
+void body_store_destroy (struct body_store *store)
+{
+  assert (store != NULL);
+  if (store->map != NULL)
+    {
+      munmap (store->map, store->map_size);
+      store->map = NULL;
+    }
+  else
+    {
+#define FREE(F) free (store->F);
+      BODY_ARRAYS (FREE)
+#undef FREE
+    }
+  free (store->handle);
+  free (store->slots);
+  store->cnt = 0;
+  store->cap = 0;
+}
+
+/* Makes room in STORE for at least CAP bodies.  Moves the arrays,
+   so pointers into them are invalidated; a mapped store moves to
+   the heap. */
+void body_store_reserve (struct body_store *store, size_t cap)
+{
+  if (cap <= store->cap)
+    return;
+  bool owned = store->map == NULL;
+#define MOVE(F) \
+  store->F = move_array (store->F, store->cnt, cap, sizeof *store->F, owned);
+  BODY_ARRAYS (MOVE)
+#undef MOVE
+  store->handle = move_array (store->handle, store->cnt, cap,
+                              sizeof *store->handle, true);
+  if (!owned)
+    {
+      munmap (store->map, store->map_size);
+      store->map = NULL;
+      store->map_size = 0;
+    }
+  store->cap = cap;
+}
+
+/* Appends a zeroed body to STORE, growing it as needed, and returns
+   its handle.  The body's index is the old count. */
+body_handle body_store_add (struct body_store *store)
+{
+  if (store->cnt == store->cap)
+    body_store_reserve (store, store->cap < 16 ? 16 : 2 * store->cap);
+
+  size_t i = store->cnt++;
+#define ZERO(F) memset (&store->F[i], 0, sizeof store->F[i]);
+  BODY_ARRAYS (ZERO)
+#undef ZERO
+  uint32_t slot = slot_alloc (store);
+  store->slots[slot].index = i;
+  store->handle[i] = (body_handle) store->slots[slot].generation << 32 | slot;
+  return store->handle[i];
+}
+
+/* Removes body I from STORE by moving the last body into its
+   place.  The moved body keeps its handle. */
+void body_store_remove (struct body_store *store, size_t i)
+{
+  assert (i < store->cnt);
+  slot_free (store, (uint32_t) store->handle[i]);
+
+  size_t last = --store->cnt;
+  if (i == last)
+    return;
+#define MOVE(F) store->F[i] = store->F[last];
+  BODY_ARRAYS (MOVE)
+#undef MOVE
+  store->handle[i] = store->handle[last];
+  store->slots[(uint32_t) store->handle[i]].index = i;
+}
+
+/* Removes every body I of STORE with DEAD[I] set, moving the rest
+   down so they stay in order.  Returns the number removed. */
+size_t body_store_compact (struct body_store *store, const unsigned char *dead)
+{
+  size_t cnt = store->cnt;
+  size_t i = 0;
+  while (i < cnt && !dead[i])
+    i++;
+
+  size_t to = i;
+  for (; i < cnt; i++)
+    {
+      if (dead[i])
+        {
+          slot_free (store, (uint32_t) store->handle[i]);
+          continue;
+        }
+#define MOVE(F) store->F[to] = store->F[i];
+      BODY_ARRAYS (MOVE)
+#undef MOVE
+      store->handle[to] = store->handle[i];
+      store->slots[(uint32_t) store->handle[to]].index = to;
+      to++;
+    }
+  store->cnt = to;
+  return cnt - to;
+}
+
+/* Returns the index of the body of HANDLE in STORE, or BODY_NONE if
+   it has been removed. */
+size_t body_store_find (const struct body_store *store, body_handle handle)
+{
+  uint32_t slot = (uint32_t) handle;
+  if (slot >= store->slot_cnt
+      || store->slots[slot].generation != (uint32_t) (handle >> 32))
+    return BODY_NONE;
+  return store->slots[slot].index;
+}
+
+/* Gives the CNT bodies of STORE handles 0..CNT - 1. */
+static void handles_init (struct body_store *store, size_t cnt)
+{
+  store->handle = alloc_array (cnt, sizeof *store->handle);
+  store->slots = alloc_array (cnt, sizeof *store->slots);
+  store->slot_cnt = cnt;
+  store->slot_cap = cnt;
+  store->free_slot = UINT32_MAX;
+  for (size_t i = 0; i < cnt; i++)
+    {
+      store->handle[i] = i;
+      store->slots[i].index = i;
+    }
+}
+
+/* Returns a free handle slot of STORE, reusing a freed one if there
+   is one. */
+static uint32_t slot_alloc (struct body_store *store)
+{
+  if (store->free_slot != UINT32_MAX)
+    {
+      uint32_t slot = store->free_slot;
+      store->free_slot = store->slots[slot].next_free;
+      return slot;
+    }
+  if (store->slot_cnt == store->slot_cap)
+    {
+      size_t cap = store->slot_cap < 16 ? 16 : 2 * store->slot_cap;
+      store->slots = move_array (store->slots, store->slot_cnt, cap,
+                                 sizeof *store->slots, true);
+      store->slot_cap = cap;
+    }
+  assert (store->slot_cnt < UINT32_MAX);
+  return store->slot_cnt++;
+}
+
+/* Retires SLOT of STORE: its handle goes stale and the slot is
+   queued for reuse. */
+static void slot_free (struct body_store *store, uint32_t slot)
+{
+  store->slots[slot].index = BODY_NONE;
+  store->slots[slot].generation++;
+  store->slots[slot].next_free = store->free_slot;
+  store->free_slot = slot;
+}
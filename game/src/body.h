@@ -1,4 +1,10 @@
-#include "list.h"
+#ifndef BODY_H
+#define BODY_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "raylib.h"
+
 /* Screen Information */
 #define SCRNW 800
 #define SRCHT 450
@@ -7,21 +13,91 @@
 #define CENTER_X SCRNW / 2
 #define CENTER_Y SRCHT / 2
 
-/* Body Object */
-struct body 
+/* Body Store
+
+   Bodies are kept as a structure of arrays: body I is made of
+   element I of every array.  The force pass only streams through
+   positions and masses, and the position update only through
+   positions and velocities, so these live in their own
+   contiguous arrays.  Fields that are only needed to draw or to
+   test for overlap are kept apart so they never share a cache
+   line with the hot data.
+
+   The arrays are heap allocated, start on a cache line and grow
+   by doubling, so adding a body is amortised O(1).  Bodies stay
+   packed in 0..CNT - 1: removing body I moves the last body into
+   its place, also in O(1), and body_store_compact() removes any
+   number of bodies in one pass that keeps the survivors in
+   order.  Since either renumbers bodies, code that must follow a
+   body across additions and removals holds a handle instead of
+   an index.  A handle stays valid until its
+   body is removed, and body_store_find() maps it back to the
+   body's current index. */
+
+#define BODY_ALIGN 64       /* Alignment of every array. */
+#define BODY_NONE ((size_t) -1)
+
+/* Stable name of a body: slot number in the low 32 bits and the
+   slot's generation in the high 32, so handles of removed bodies
+   are recognised even after their slot is reused. */
+typedef uint64_t body_handle;
+
+/* Handle slot. */
+struct body_slot
+{
+  size_t index;             /* Body index, or BODY_NONE if free. */
+  uint32_t generation;      /* Bumped when the slot is freed. */
+  uint32_t next_free;       /* Next free slot, if free. */
+};
+
+struct body_store
 {
+  size_t cnt;       /* Number of bodies. */
+  size_t cap;       /* Bodies the arrays have room for. */
+
   /* Simulation Relevant Properties */
-  double posX;
-  double posY;
+  double *pos_x;
+  double *pos_y;
+
+  double *vel_x;
+  double *vel_y;
 
-  double vel_x;
-  double vel_y;
-  
-  double mass;
+  double *mass;
+
+  double *acc_x;    /* Acceleration from the last force pass. */
+  double *acc_y;
 
   /* Graphics Related Properties */
-  double radius;
-  struct Color color; 
-  
-  struct list_elem elem;
+  double *radius;
+  Color *color;
+
+  /* Handles */
+  body_handle *handle;        /* Per body: its handle. */
+  struct body_slot *slots;
+  size_t slot_cnt;
+  size_t slot_cap;
+  uint32_t free_slot;         /* First free slot, or UINT32_MAX. */
+
+  /* Memory mapping the arrays point into, or NULL if they are
+     on the heap (see checkpoint_load()). */
+  void *map;
+  size_t map_size;
 };
+
+/* Applies X to the name of every per-body data array, that is,
+   every array but HANDLE. */
+#define BODY_ARRAYS(X) \
+  X (pos_x) X (pos_y) X (vel_x) X (vel_y) X (mass) \
+  X (acc_x) X (acc_y) X (radius) X (color)
+
+void body_store_init (struct body_store *, size_t cnt);
+void body_store_init_mapped (struct body_store *, size_t cnt, void *map,
+                             size_t map_size);
+void body_store_destroy (struct body_store *);
+void body_store_reserve (struct body_store *, size_t cap);
+body_handle body_store_add (struct body_store *);
+void body_store_remove (struct body_store *, size_t i);
+size_t body_store_compact (struct body_store *, const unsigned char *dead);
+size_t body_store_find (const struct body_store *, body_handle);
+
+#endif /* body.h */
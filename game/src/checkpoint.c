@@ -0,0 +1,505 @@
+#include "checkpoint.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static size_t field_size (enum checkpoint_field f);
+static size_t layout (struct checkpoint_header *hdr, size_t cnt,
+                      size_t contact_cnt);
+static size_t contacts_save (const struct sim *sim,
+                             struct checkpoint_contact *out);
+static const void *field_src (const struct sim *sim, enum checkpoint_field f);
+static size_t image_build (const struct sim *sim, unsigned char **image,
+                           size_t *cap);
+static bool write_file (const char *path, const unsigned char *image,
+                        size_t size);
+static bool header_check (struct checkpoint_header *hdr, size_t size,
+                          bool *swapped, const char *path);
+static void header_swap (struct checkpoint_header *hdr);
+static void copy_field (void *dst, const unsigned char *src, size_t cnt,
+                        size_t elem, bool swapped);
+static void *writer_main (void *w_);
+
+/* Returns the size in bytes of one element of field F. */
+static size_t field_size (enum checkpoint_field f)
+{
+  switch (f)
+    {
+    case CKP_COLOR: return sizeof (Color);
+    case CKP_LEVEL: return 1;
+    default: return sizeof (double);
+    }
+}
+
+/* Fills in the offsets of HDR for CNT bodies and CONTACT_CNT
+   contacts and returns the size of the file. */
+static size_t layout (struct checkpoint_header *hdr, size_t cnt,
+                      size_t contact_cnt)
+{
+  size_t ofs = sizeof *hdr;
+  for (int f = 0; f < CKP_FIELD_CNT; f++)
+    {
+      ofs = (ofs + CHECKPOINT_ALIGN - 1) / CHECKPOINT_ALIGN * CHECKPOINT_ALIGN;
+      hdr->offset[f] = ofs;
+      ofs += cnt * field_size (f);
+    }
+  ofs = (ofs + CHECKPOINT_ALIGN - 1) / CHECKPOINT_ALIGN * CHECKPOINT_ALIGN;
+  hdr->contact_cnt = contact_cnt;
+  hdr->contact_offset = ofs;
+  return ofs + contact_cnt * sizeof (struct checkpoint_contact);
+}
+
+/* Stores the cached contacts of SIM whose bodies still exist in
+   OUT, if not null, and returns their number. */
+static size_t contacts_save (const struct sim *sim,
+                             struct checkpoint_contact *out)
+{
+  const struct contact_solver *cs = &sim->contacts;
+  size_t cnt = 0;
+  for (size_t k = 0; k < cs->cache_cap; k++)
+    {
+      const struct contact_entry *e = &cs->cache[k];
+      if (e->a == e->b)
+        continue;
+      size_t a = body_store_find (&sim->bodies, e->a);
+      size_t b = body_store_find (&sim->bodies, e->b);
+      if (a == BODY_NONE || b == BODY_NONE)
+        continue;
+      if (out != NULL)
+        out[cnt] = (struct checkpoint_contact) {a, b, e->impulse};
+      cnt++;
+    }
+  return cnt;
+}
+
+/* Returns the array of SIM that holds field F. */
+static const void *field_src (const struct sim *sim, enum checkpoint_field f)
+{
+  const struct body_store *b = &sim->bodies;
+  switch (f)
+    {
+    case CKP_POS_X: return b->pos_x;
+    case CKP_POS_Y: return b->pos_y;
+    case CKP_VEL_X: return b->vel_x;
+    case CKP_VEL_Y: return b->vel_y;
+    case CKP_MASS: return b->mass;
+    case CKP_ACC_X: return b->acc_x;
+    case CKP_ACC_Y: return b->acc_y;
+    case CKP_RADIUS: return b->radius;
+    case CKP_COLOR: return b->color;
+    case CKP_LEVEL: return sim->block.level;
+    case CKP_PREV_ACC_X: return sim->block.prev_acc_x;
+    case CKP_PREV_ACC_Y: return sim->block.prev_acc_y;
+    default: return NULL;
+    }
+}
+
+/* Lays out the checkpoint of SIM in *IMAGE, growing it (and *CAP)
+   as needed, and returns its size.  Exits on out of memory. */
+static size_t image_build (const struct sim *sim, unsigned char **image,
+                           size_t *cap)
+{
+  struct checkpoint_header hdr;
+  memset (&hdr, 0, sizeof hdr);
+  memcpy (hdr.magic, CHECKPOINT_MAGIC, sizeof hdr.magic);
+  hdr.version = CHECKPOINT_VERSION;
+  hdr.endian = CHECKPOINT_ENDIAN;
+  hdr.cnt = sim->bodies.cnt;
+  hdr.step_cnt = sim->step_cnt;
+  hdr.time = sim->step_cnt * sim->dt;
+  hdr.dt = sim->dt;
+  hdr.seed = sim->seed;
+  hdr.integrator = sim->integrator;
+  hdr.solver = sim->solver;
+  hdr.softening = sim->direct.softening;
+  hdr.block_levels = sim->block.max_level;
+  hdr.eps = sim->direct.eps;
+  hdr.theta = sim->tree.theta;
+  hdr.flags = (sim->acc_fresh ? CKP_ACC_FRESH : 0)
+              | (sim->block.primed ? CKP_BLOCK_PRIMED : 0)
+              | (sim->collisions == COLLISION_MERGE ? CKP_MERGE : 0)
+              | (sim->collisions == COLLISION_NONE ? CKP_NO_COLLISIONS : 0);
+  hdr.field_cnt = CKP_FIELD_CNT;
+  hdr.restitution = sim->contacts.restitution;
+  hdr.contact_iterations = sim->contacts.iterations;
+  size_t size = layout (&hdr, sim->bodies.cnt, contacts_save (sim, NULL));
+
+  if (*cap < size)
+    {
+      free (*image);
+      *image = malloc (size);
+      if (*image == NULL)
+        {
+          fprintf (stderr, "checkpoint: out of memory\n");
+          exit (1);
+        }
+      *cap = size;
+    }
+
+  /* Zero the padding too, so files are reproducible. */
+  memset (*image, 0, size);
+  memcpy (*image, &hdr, sizeof hdr);
+  for (int f = 0; f < CKP_FIELD_CNT; f++)
+    memcpy (*image + hdr.offset[f], field_src (sim, f),
+            sim->bodies.cnt * field_size (f));
+  contacts_save (sim, (struct checkpoint_contact *) (*image
+                                                     + hdr.contact_offset));
+  return size;
+}
+
+/* Writes SIZE bytes of IMAGE to PATH by way of a temporary file,
+   so PATH always holds either the old or the new checkpoint.
+   Returns false on failure. */
+static bool write_file (const char *path, const unsigned char *image,
+                        size_t size)
+{
+  size_t len = strlen (path);
+  char *tmp = malloc (len + 5);
+  if (tmp == NULL)
+    return false;
+  memcpy (tmp, path, len);
+  memcpy (tmp + len, ".tmp", 5);
+
+  bool ok = false;
+  FILE *file = fopen (tmp, "wb");
+  if (file != NULL)
+    {
+      ok = fwrite (image, 1, size, file) == size;
+      ok = (fclose (file) == 0) && ok;
+      ok = ok && rename (tmp, path) == 0;
+      if (!ok)
+        remove (tmp);
+    }
+  if (!ok)
+    fprintf (stderr, "checkpoint: cannot write %s\n", path);
+  free (tmp);
+  return ok;
+}
+
+/* Writes the checkpoint of SIM to PATH and returns true on success.
+   Blocks until the file is written. */
+bool checkpoint_save (const struct sim *sim, const char *path)
+{
+  unsigned char *image = NULL;
+  size_t cap = 0;
+  size_t size = image_build (sim, &image, &cap);
+  bool ok = write_file (path, image, size);
+  free (image);
+  return ok;
+}
+
+/* Checks the SIZE byte file starting with HDR, read from PATH, and
+   brings HDR into native byte order.  Sets *SWAPPED if the file
+   was written in the other byte order.  Returns false, after
+   printing why, if the file is not a checkpoint this build can
+   read. */
+static bool header_check (struct checkpoint_header *hdr, size_t size,
+                          bool *swapped, const char *path)
+{
+  if (size < sizeof *hdr
+      || memcmp (hdr->magic, CHECKPOINT_MAGIC, sizeof hdr->magic) != 0)
+    {
+      fprintf (stderr, "checkpoint: %s: not a checkpoint\n", path);
+      return false;
+    }
+
+  *swapped = hdr->endian != CHECKPOINT_ENDIAN;
+  if (*swapped)
+    {
+      if (__builtin_bswap32 (hdr->endian) != CHECKPOINT_ENDIAN)
+        {
+          fprintf (stderr, "checkpoint: %s: unknown byte order\n", path);
+          return false;
+        }
+      header_swap (hdr);
+    }
+
+  if (hdr->version != CHECKPOINT_VERSION || hdr->field_cnt != CKP_FIELD_CNT)
+    {
+      fprintf (stderr, "checkpoint: %s: unsupported version %u\n",
+               path, (unsigned) hdr->version);
+      return false;
+    }
+  if (hdr->integrator >= INTEGRATOR_CNT || hdr->solver >= SOLVER_CNT
+      || hdr->softening >= GRAVITY_SOFT_CNT
+      || hdr->block_levels > BLOCK_MAX_LEVEL || !(hdr->dt > 0)
+      || hdr->contact_iterations == 0
+      || !(hdr->restitution >= 0 && hdr->restitution <= 1))
+    {
+      fprintf (stderr, "checkpoint: %s: bad settings\n", path);
+      return false;
+    }
+
+  /* Fields may not run past the end of the file, and must be
+     aligned for in-place use. */
+  for (int f = 0; f < CKP_FIELD_CNT; f++)
+    {
+      uint64_t ofs = hdr->offset[f];
+      if (ofs % sizeof (double) != 0 || ofs > size
+          || hdr->cnt > (size - ofs) / field_size (f))
+        {
+          fprintf (stderr, "checkpoint: %s: truncated\n", path);
+          return false;
+        }
+    }
+  if (hdr->contact_offset % sizeof (double) != 0 || hdr->contact_offset > size
+      || hdr->contact_cnt > ((size - hdr->contact_offset)
+                             / sizeof (struct checkpoint_contact)))
+    {
+      fprintf (stderr, "checkpoint: %s: truncated\n", path);
+      return false;
+    }
+  return true;
+}
+
+/* Swaps the byte order of every multi-byte field of HDR. */
+static void header_swap (struct checkpoint_header *hdr)
+{
+#define SWAP32(X) ((X) = __builtin_bswap32 (X))
+#define SWAP64(X) ((X) = __builtin_bswap64 (X))
+#define SWAPD(X) copy_field (&(X), (const unsigned char *) &(X), 1, 8, true)
+  SWAP32 (hdr->version);
+  SWAP32 (hdr->endian);
+  SWAP64 (hdr->cnt);
+  SWAP64 (hdr->step_cnt);
+  SWAPD (hdr->time);
+  SWAPD (hdr->dt);
+  SWAP64 (hdr->seed);
+  SWAP32 (hdr->integrator);
+  SWAP32 (hdr->solver);
+  SWAP32 (hdr->softening);
+  SWAP32 (hdr->block_levels);
+  SWAPD (hdr->eps);
+  SWAPD (hdr->theta);
+  SWAP32 (hdr->flags);
+  SWAP32 (hdr->field_cnt);
+  for (int f = 0; f < CKP_FIELD_CNT; f++)
+    SWAP64 (hdr->offset[f]);
+  SWAPD (hdr->restitution);
+  SWAP32 (hdr->contact_iterations);
+  SWAP64 (hdr->contact_cnt);
+  SWAP64 (hdr->contact_offset);
+#undef SWAP32
+#undef SWAP64
+#undef SWAPD
+}
+
+/* Copies CNT elements of ELEM bytes from SRC to DST, reversing the
+   bytes of each element if SWAPPED.  DST and SRC may be the
+   same. */
+static void copy_field (void *dst, const unsigned char *src, size_t cnt,
+                        size_t elem, bool swapped)
+{
+  if (!swapped || elem == 1)
+    {
+      memmove (dst, src, cnt * elem);
+      return;
+    }
+  unsigned char *d = dst;
+  for (size_t i = 0; i < cnt; i++, d += elem, src += elem)
+    {
+      unsigned char tmp[8];
+      assert (elem <= sizeof tmp);
+      for (size_t b = 0; b < elem; b++)
+        tmp[b] = src[elem - 1 - b];
+      memcpy (d, tmp, elem);
+    }
+}
+
+/* Replaces the state of SIM by the checkpoint at PATH.  Returns
+   false, leaving SIM as it was, if PATH cannot be read.
+
+   The file is mapped privately, so when its byte order matches,
+   the body arrays are used in place and writes to them never reach
+   the file.  The worker count, kernel ISA and precision are not
+   part of a checkpoint and stay as they are. */
+bool checkpoint_load (struct sim *sim, const char *path)
+{
+  int fd = open (path, O_RDONLY);
+  if (fd < 0)
+    {
+      fprintf (stderr, "checkpoint: cannot open %s\n", path);
+      return false;
+    }
+  struct stat st;
+  void *map = MAP_FAILED;
+  if (fstat (fd, &st) == 0 && st.st_size > 0)
+    map = mmap (NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close (fd);
+  if (map == MAP_FAILED)
+    {
+      fprintf (stderr, "checkpoint: cannot map %s\n", path);
+      return false;
+    }
+  size_t size = st.st_size;
+
+  struct checkpoint_header hdr;
+  bool swapped;
+  memcpy (&hdr, map, sizeof hdr < size ? sizeof hdr : size);
+  if (!header_check (&hdr, size, &swapped, path))
+    {
+      munmap (map, size);
+      return false;
+    }
+
+  /* Body arrays: in place if possible, else swapped into a store of
+     their own.  The block arrays are always copied, as SIM keeps
+     its own. */
+  const unsigned char *base = map;
+  struct body_store store;
+  if (!swapped)
+    {
+      body_store_init_mapped (&store, hdr.cnt, map, size);
+      store.pos_x = (double *) (base + hdr.offset[CKP_POS_X]);
+      store.pos_y = (double *) (base + hdr.offset[CKP_POS_Y]);
+      store.vel_x = (double *) (base + hdr.offset[CKP_VEL_X]);
+      store.vel_y = (double *) (base + hdr.offset[CKP_VEL_Y]);
+      store.mass = (double *) (base + hdr.offset[CKP_MASS]);
+      store.acc_x = (double *) (base + hdr.offset[CKP_ACC_X]);
+      store.acc_y = (double *) (base + hdr.offset[CKP_ACC_Y]);
+      store.radius = (double *) (base + hdr.offset[CKP_RADIUS]);
+      store.color = (Color *) (base + hdr.offset[CKP_COLOR]);
+    }
+  else
+    {
+      body_store_init (&store, hdr.cnt);
+      void *dst[] = {
+        [CKP_POS_X] = store.pos_x, [CKP_POS_Y] = store.pos_y,
+        [CKP_VEL_X] = store.vel_x, [CKP_VEL_Y] = store.vel_y,
+        [CKP_MASS] = store.mass,
+        [CKP_ACC_X] = store.acc_x, [CKP_ACC_Y] = store.acc_y,
+        [CKP_RADIUS] = store.radius, [CKP_COLOR] = store.color,
+      };
+      /* Colors are bytes, so only the doubles are swapped. */
+      for (int f = CKP_POS_X; f <= CKP_COLOR; f++)
+        copy_field (dst[f], base + hdr.offset[f], hdr.cnt, field_size (f),
+                    f != CKP_COLOR);
+    }
+  sim_set_bodies (sim, &store);
+
+  struct block_steps *blk = &sim->block;
+  copy_field (blk->level, base + hdr.offset[CKP_LEVEL], hdr.cnt, 1, swapped);
+  copy_field (blk->prev_acc_x, base + hdr.offset[CKP_PREV_ACC_X], hdr.cnt,
+              sizeof (double), swapped);
+  copy_field (blk->prev_acc_y, base + hdr.offset[CKP_PREV_ACC_Y], hdr.cnt,
+              sizeof (double), swapped);
+
+  /* Handles were handed out by index, so a contact's body indices
+     find its bodies' new handles */
+  for (uint64_t k = 0; k < hdr.contact_cnt; k++)
+    {
+      struct checkpoint_contact c;
+      copy_field (&c, base + hdr.contact_offset + k * sizeof c,
+                  3, sizeof (uint64_t), swapped);
+      if (c.a < hdr.cnt && c.b < hdr.cnt)
+        contact_cache_put (&sim->contacts, sim->bodies.handle[c.a],
+                           sim->bodies.handle[c.b], c.impulse);
+    }
+  if (swapped)
+    munmap (map, size);
+
+  sim->dt = hdr.dt;
+  sim->seed = hdr.seed;
+  sim->step_cnt = hdr.step_cnt;
+  sim->integrator = hdr.integrator;
+  sim->solver = hdr.solver;
+  sim->tree.theta = hdr.theta;
+  sim->contacts.restitution = hdr.restitution;
+  sim->contacts.iterations = hdr.contact_iterations;
+  sim_set_softening (sim, hdr.softening, hdr.eps);
+  blk->max_level = hdr.block_levels;
+  sim->acc_fresh = (hdr.flags & CKP_ACC_FRESH) != 0;
+  blk->primed = (hdr.flags & CKP_BLOCK_PRIMED) != 0;
+  sim->collisions = (hdr.flags & CKP_MERGE) ? COLLISION_MERGE
+                    : (hdr.flags & CKP_NO_COLLISIONS) ? COLLISION_NONE
+                    : COLLISION_BOUNCE;
+  return true;
+}
+
+/* Initializes W and starts its thread.  Exits on failure. */
+void checkpoint_writer_init (struct checkpoint_writer *w)
+{
+  assert (w != NULL);
+  w->pending = false;
+  w->exiting = false;
+  w->path = NULL;
+  w->image = NULL;
+  w->size = 0;
+  w->cap = 0;
+  pthread_mutex_init (&w->lock, NULL);
+  pthread_cond_init (&w->cond, NULL);
+  if (pthread_create (&w->thread, NULL, writer_main, w) != 0)
+    {
+      fprintf (stderr, "checkpoint: cannot create writer thread\n");
+      exit (1);
+    }
+}
+
+/* Finishes the pending write of W, if any, stops its thread and
+   frees its memory. */
+void checkpoint_writer_destroy (struct checkpoint_writer *w)
+{
+  pthread_mutex_lock (&w->lock);
+  w->exiting = true;
+  pthread_cond_broadcast (&w->cond);
+  pthread_mutex_unlock (&w->lock);
+  pthread_join (w->thread, NULL);
+
+  pthread_cond_destroy (&w->cond);
+  pthread_mutex_destroy (&w->lock);
+  free (w->path);
+  free (w->image);
+}
+
+/* Queues the checkpoint of SIM to be written to PATH by W.  Only
+   waits if the previous checkpoint is still being written. */
+void checkpoint_writer_submit (struct checkpoint_writer *w,
+                               const struct sim *sim, const char *path)
+{
+  pthread_mutex_lock (&w->lock);
+  while (w->pending)
+    pthread_cond_wait (&w->cond, &w->lock);
+
+  /* The thread is idle until PENDING is set, so the buffer is
+     ours. */
+  w->size = image_build (sim, &w->image, &w->cap);
+  if (w->path == NULL || strcmp (w->path, path) != 0)
+    {
+      free (w->path);
+      w->path = strdup (path);
+    }
+  w->pending = w->path != NULL;
+  pthread_cond_broadcast (&w->cond);
+  pthread_mutex_unlock (&w->lock);
+}
+
+/* Writes the checkpoints submitted to W_ until asked to exit. */
+static void *writer_main (void *w_)
+{
+  struct checkpoint_writer *w = w_;
+
+  pthread_mutex_lock (&w->lock);
+  for (;;)
+    {
+      while (!w->pending && !w->exiting)
+        pthread_cond_wait (&w->cond, &w->lock);
+      if (!w->pending)
+        break;
+
+      /* Submitters wait on PENDING, so the buffer stays put while
+         the lock is released for the write. */
+      pthread_mutex_unlock (&w->lock);
+      write_file (w->path, w->image, w->size);
+      pthread_mutex_lock (&w->lock);
+
+      w->pending = false;
+      pthread_cond_broadcast (&w->cond);
+    }
+  pthread_mutex_unlock (&w->lock);
+  return NULL;
+}
@@ -0,0 +1,125 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "sim.h"
+
+/* Checkpoints.
+
+   A checkpoint holds everything needed to continue a run exactly
+   where it stopped: the bodies, the cached accelerations, block
+   levels and contact impulses, and the settings that shape a
+   step.  Random
+   streams are keyed by the seed and the step count (see rng.h),
+   so those two are the complete RNG state.
+
+   The file is a fixed header followed by one contiguous array per
+   body field, then the contact cache, each starting on a
+   CHECKPOINT_ALIGN byte boundary at the offset recorded in the
+   header.  Numbers are stored in the
+   writer's byte order; the header's ENDIAN field tells the reader
+   which one that was.
+
+   checkpoint_load() maps the file copy-on-write and, when the
+   version and byte order match, points the body arrays straight
+   into the mapping, so loading costs no copy and pages are only
+   duplicated as bodies move.  A checkpoint from a machine of the
+   other byte order is copied and swapped instead.
+
+   A checkpoint_writer saves in the background: submitting copies
+   the state into a buffer, which a thread of its own writes to a
+   temporary file and renames into place, so the step loop only
+   pays for the copy and a reader never sees a partial file. */
+
+#define CHECKPOINT_MAGIC "NBODYCKP"
+#define CHECKPOINT_VERSION 2
+#define CHECKPOINT_ENDIAN 0x01020304u
+#define CHECKPOINT_ALIGN 64
+
+/* Body fields, in file order. */
+enum checkpoint_field
+{
+  CKP_POS_X,
+  CKP_POS_Y,
+  CKP_VEL_X,
+  CKP_VEL_Y,
+  CKP_MASS,
+  CKP_ACC_X,
+  CKP_ACC_Y,
+  CKP_RADIUS,
+  CKP_COLOR,            /* 4 bytes: r, g, b, a. */
+  CKP_LEVEL,            /* 1 byte: block time step level. */
+  CKP_PREV_ACC_X,       /* Block time step jerk estimate. */
+  CKP_PREV_ACC_Y,
+  CKP_FIELD_CNT
+};
+
+/* Header flags. */
+#define CKP_ACC_FRESH 1         /* ACC matches the positions. */
+#define CKP_BLOCK_PRIMED 2      /* LEVEL and PREV_ACC are valid. */
+#define CKP_MERGE 4             /* Colliding bodies merge. */
+#define CKP_NO_COLLISIONS 8     /* Bodies pass through each other. */
+
+/* File header. */
+struct checkpoint_header
+{
+  char magic[8];              /* CHECKPOINT_MAGIC, not terminated. */
+  uint32_t version;
+  uint32_t endian;            /* CHECKPOINT_ENDIAN as written. */
+  uint64_t cnt;               /* Bodies. */
+  uint64_t step_cnt;
+  double time;                /* Simulated time, STEP_CNT * DT. */
+  double dt;
+  uint64_t seed;
+  uint32_t integrator;        /* enum integrator. */
+  uint32_t solver;            /* enum force_solver. */
+  uint32_t softening;         /* enum gravity_softening. */
+  uint32_t block_levels;
+  double eps;
+  double theta;
+  uint32_t flags;
+  uint32_t field_cnt;         /* CKP_FIELD_CNT. */
+  uint64_t offset[CKP_FIELD_CNT];   /* Byte offset of each field. */
+  double restitution;
+  uint32_t contact_iterations;
+  uint32_t reserved;
+  uint64_t contact_cnt;       /* Cached contacts. */
+  uint64_t contact_offset;    /* Byte offset of the contacts. */
+};
+
+/* Cached contact, by body index. */
+struct checkpoint_contact
+{
+  uint64_t a;
+  uint64_t b;
+  double impulse;
+};
+
+/* Background checkpoint writer. */
+struct checkpoint_writer
+{
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;        /* Signaled when PENDING or EXITING
+                                 change. */
+
+  /* Protected by LOCK. */
+  bool pending;               /* IMAGE waits to be written. */
+  bool exiting;
+  char *path;
+  unsigned char *image;       /* File contents. */
+  size_t size;
+  size_t cap;
+};
+
+bool checkpoint_save (const struct sim *, const char *path);
+bool checkpoint_load (struct sim *, const char *path);
+
+void checkpoint_writer_init (struct checkpoint_writer *);
+void checkpoint_writer_destroy (struct checkpoint_writer *);
+void checkpoint_writer_submit (struct checkpoint_writer *,
+                               const struct sim *, const char *path);
+
+#endif /* checkpoint.h */
@@ -0,0 +1,323 @@
+#include "contact.h"
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void *grow (void *p, size_t cnt, size_t size);
+static size_t cache_slot (const struct contact_solver *cs, body_handle a,
+                          body_handle b);
+static double cache_get (const struct contact_solver *cs, body_handle a,
+                         body_handle b);
+static void cache_rebuild (struct contact_solver *cs,
+                           const struct body_store *bodies);
+static void apply_impulse (struct body_store *bodies, const struct contact *c,
+                           double impulse);
+static size_t velocity_sweep (struct contact_solver *cs,
+                              struct body_store *bodies, double tolerance);
+static size_t position_sweep (struct contact_solver *cs,
+                              struct body_store *bodies);
+
+/* Initializes CS with no contacts and the default settings. */
+void contact_solver_init (struct contact_solver *cs)
+{
+  assert (cs != NULL);
+  cs->iterations = 8;
+  cs->restitution = .8;
+  cs->contacts = NULL;
+  cs->cnt = 0;
+  cs->cap = 0;
+  cs->cache = NULL;
+  cs->cache_cnt = 0;
+  cs->cache_cap = 0;
+  cs->warm_started = 0;
+  cs->sweeps = 0;
+  cs->visits = 0;
+  cs->corrections = 0;
+}
+
+/* Frees the memory held by CS. */
+void contact_solver_destroy (struct contact_solver *cs)
+{
+  assert (cs != NULL);
+  free (cs->contacts);
+  free (cs->cache);
+  cs->contacts = NULL;
+  cs->cache = NULL;
+  cs->cnt = cs->cap = 0;
+  cs->cache_cnt = cs->cache_cap = 0;
+}
+
+/* Forgets the cached contacts of CS, so the next pass starts
+   cold. */
+void contact_solver_clear (struct contact_solver *cs)
+{
+  if (cs->cache_cnt > 0)
+    memset (cs->cache, 0, cs->cache_cap * sizeof *cs->cache);
+  cs->cache_cnt = 0;
+  cs->cnt = 0;
+}
+
+/* Finds the overlapping pairs among the PAIR_CNT candidate PAIRS
+   of BODIES, in order, and resolves them with CS: their
+   velocities first, then what overlap is left.  The cache then
+   holds the contacts of this pass. */
+void contact_solve (struct contact_solver *cs, struct body_store *bodies,
+                    const struct grid_pair *pairs, size_t pair_cnt)
+{
+  const double *pos_x = bodies->pos_x;
+  const double *pos_y = bodies->pos_y;
+  const double *radius = bodies->radius;
+
+  cs->cnt = 0;
+  cs->warm_started = 0;
+  cs->sweeps = 0;
+  cs->visits = 0;
+  cs->corrections = 0;
+
+  /* Narrow phase: every candidate is tested once, here */
+  double max_speed = 0;
+  for (size_t p = 0; p < pair_cnt; p++)
+    {
+      uint32_t a = pairs[p].a;
+      uint32_t b = pairs[p].b;
+      double dx = pos_x[a] - pos_x[b];
+      double dy = pos_y[a] - pos_y[b];
+      double reach = radius[a] + radius[b];
+      double d2 = dx * dx + dy * dy;
+      /* A massless tracer takes no impulse */
+      if (d2 >= reach * reach || !(bodies->mass[a] > 0)
+          || !(bodies->mass[b] > 0))
+        continue;
+      double inv_mass = 1 / bodies->mass[a] + 1 / bodies->mass[b];
+      if (!(inv_mass > 0))
+        continue;
+
+      if (cs->cnt == cs->cap)
+        {
+          cs->cap = cs->cap ? 2 * cs->cap : 256;
+          cs->contacts = grow (cs->contacts, cs->cap, sizeof *cs->contacts);
+        }
+      struct contact *c = &cs->contacts[cs->cnt++];
+      double d = sqrt (d2);
+      c->a = a;
+      c->b = b;
+      c->nx = (d > 0) ? dx / d : 1;
+      c->ny = (d > 0) ? dy / d : 0;
+      c->mass = 1 / inv_mass;
+
+      /* Approaching pairs bounce; resting ones just stop */
+      double vn = (bodies->vel_x[a] - bodies->vel_x[b]) * c->nx
+                  + (bodies->vel_y[a] - bodies->vel_y[b]) * c->ny;
+      c->target = (vn < 0) ? -cs->restitution * vn : 0;
+      if (fabs (vn) > max_speed)
+        max_speed = fabs (vn);
+
+      c->impulse = cache_get (cs, bodies->handle[a], bodies->handle[b]);
+      if (c->impulse > 0)
+        {
+          apply_impulse (bodies, c, c->impulse);
+          cs->warm_started++;
+        }
+    }
+
+  double tolerance = CONTACT_TOLERANCE * max_speed;
+  for (int s = 0; s < cs->iterations && cs->cnt > 0; s++)
+    if (velocity_sweep (cs, bodies, tolerance) == 0)
+      break;
+  for (int s = 0; s < cs->iterations && cs->cnt > 0; s++)
+    if (position_sweep (cs, bodies) == 0)
+      break;
+
+  cache_rebuild (cs, bodies);
+}
+
+/* Adds the pair of bodies with handles A and B to the cache of
+   CS with IMPULSE, for restoring a saved cache. */
+void contact_cache_put (struct contact_solver *cs, body_handle a,
+                        body_handle b, double impulse)
+{
+  if (a == b)
+    return;
+  if (2 * (cs->cache_cnt + 1) > cs->cache_cap)
+    {
+      /* Re-insert the old entries into a table twice the size */
+      struct contact_entry *old = cs->cache;
+      size_t old_cap = cs->cache_cap;
+      cs->cache_cap = old_cap ? 2 * old_cap : 64;
+      cs->cache = calloc (cs->cache_cap, sizeof *cs->cache);
+      if (cs->cache == NULL)
+        {
+          fprintf (stderr, "contact: out of memory\n");
+          exit (1);
+        }
+      cs->cache_cnt = 0;
+      for (size_t k = 0; k < old_cap; k++)
+        if (old[k].a != old[k].b)
+          contact_cache_put (cs, old[k].a, old[k].b, old[k].impulse);
+      free (old);
+    }
+
+  size_t k = cache_slot (cs, a, b);
+  if (cs->cache[k].a == cs->cache[k].b)
+    cs->cache_cnt++;
+  cs->cache[k].a = (a < b) ? a : b;
+  cs->cache[k].b = (a < b) ? b : a;
+  cs->cache[k].impulse = impulse;
+}
+
+/* Returns the slot of the cache of CS that holds the pair of
+   handles A and B, or the empty slot where it would go.  The cache
+   must have an empty slot. */
+static size_t cache_slot (const struct contact_solver *cs, body_handle a,
+                          body_handle b)
+{
+  if (a > b)
+    {
+      body_handle t = a;
+      a = b;
+      b = t;
+    }
+  size_t mask = cs->cache_cap - 1;
+  uint64_t h = a * 0x9E3779B185EBCA87ull ^ b * 0xC2B2AE3D27D4EB4Full;
+  for (size_t k = (h ^ (h >> 29)) & mask;; k = (k + 1) & mask)
+    {
+      const struct contact_entry *e = &cs->cache[k];
+      if (e->a == e->b || (e->a == a && e->b == b))
+        return k;
+    }
+}
+
+/* Returns the cached impulse of the pair of handles A and B in CS,
+   or 0 if the pair did not touch in the last pass. */
+static double cache_get (const struct contact_solver *cs, body_handle a,
+                         body_handle b)
+{
+  if (cs->cache_cnt == 0)
+    return 0;
+  const struct contact_entry *e = &cs->cache[cache_slot (cs, a, b)];
+  return (e->a != e->b) ? e->impulse : 0;
+}
+
+/* Replaces the cache of CS by the contacts of the last pass that
+   ended up pushing, keyed by the handles of their BODIES. */
+static void cache_rebuild (struct contact_solver *cs,
+                           const struct body_store *bodies)
+{
+  size_t cap = 64;
+  while (cap < 2 * cs->cnt + 2)
+    cap *= 2;
+  if (cap != cs->cache_cap)
+    {
+      free (cs->cache);
+      cs->cache = calloc (cap, sizeof *cs->cache);
+      if (cs->cache == NULL)
+        {
+          fprintf (stderr, "contact: out of memory\n");
+          exit (1);
+        }
+      cs->cache_cap = cap;
+    }
+  else if (cs->cache_cnt > 0)
+    memset (cs->cache, 0, cap * sizeof *cs->cache);
+  cs->cache_cnt = 0;
+
+  for (size_t i = 0; i < cs->cnt; i++)
+    {
+      const struct contact *c = &cs->contacts[i];
+      if (c->impulse > 0)
+        contact_cache_put (cs, bodies->handle[c->a], bodies->handle[c->b],
+                           c->impulse);
+    }
+}
+
+/* Pushes the bodies of contact C of BODIES apart by IMPULSE along
+   its normal. */
+static void apply_impulse (struct body_store *bodies, const struct contact *c,
+                           double impulse)
+{
+  double ia = impulse / bodies->mass[c->a];
+  double ib = impulse / bodies->mass[c->b];
+  bodies->vel_x[c->a] += ia * c->nx;
+  bodies->vel_y[c->a] += ia * c->ny;
+  bodies->vel_x[c->b] -= ib * c->nx;
+  bodies->vel_y[c->b] -= ib * c->ny;
+}
+
+/* Moves the impulse of every contact of CS towards the one that
+   gives its BODIES their target normal velocity, keeping it from
+   pulling.  Returns the number of contacts whose relative velocity
+   changed by more than TOLERANCE. */
+static size_t velocity_sweep (struct contact_solver *cs,
+                              struct body_store *bodies, double tolerance)
+{
+  size_t changed = 0;
+  for (size_t i = 0; i < cs->cnt; i++)
+    {
+      struct contact *c = &cs->contacts[i];
+      double vn = (bodies->vel_x[c->a] - bodies->vel_x[c->b]) * c->nx
+                  + (bodies->vel_y[c->a] - bodies->vel_y[c->b]) * c->ny;
+      double impulse = c->impulse + c->mass * (c->target - vn);
+      if (impulse < 0)
+        impulse = 0;
+      double delta = impulse - c->impulse;
+      c->impulse = impulse;
+      apply_impulse (bodies, c, delta);
+      if (fabs (delta) > tolerance * c->mass)
+        changed++;
+    }
+  cs->sweeps++;
+  cs->visits += cs->cnt;
+  return changed;
+}
+
+/* Pushes apart the bodies of every contact of CS that overlap by
+   more than twice CONTACT_SLOP of their reach, each in proportion
+   to the other's mass, until they overlap by CONTACT_SLOP.
+   Returns the number of contacts corrected. */
+static size_t position_sweep (struct contact_solver *cs,
+                              struct body_store *bodies)
+{
+  double *pos_x = bodies->pos_x;
+  double *pos_y = bodies->pos_y;
+  size_t moved = 0;
+  for (size_t i = 0; i < cs->cnt; i++)
+    {
+      const struct contact *c = &cs->contacts[i];
+      double dx = pos_x[c->a] - pos_x[c->b];
+      double dy = pos_y[c->a] - pos_y[c->b];
+      double reach = bodies->radius[c->a] + bodies->radius[c->b];
+      double d = sqrt (dx * dx + dy * dy);
+      if (d >= reach * (1 - 2 * CONTACT_SLOP))
+        continue;
+
+      double nx = (d > 0) ? dx / d : c->nx;
+      double ny = (d > 0) ? dy / d : c->ny;
+      double overlap = reach * (1 - CONTACT_SLOP) - d;
+      double wa = c->mass / bodies->mass[c->a];
+      double wb = c->mass / bodies->mass[c->b];
+      pos_x[c->a] += overlap * wa * nx;
+      pos_y[c->a] += overlap * wa * ny;
+      pos_x[c->b] -= overlap * wb * nx;
+      pos_y[c->b] -= overlap * wb * ny;
+      moved++;
+    }
+  cs->sweeps++;
+  cs->visits += cs->cnt;
+  cs->corrections += moved;
+  return moved;
+}
+
+/* Resizes P to CNT elements of SIZE bytes, exiting on failure. */
+static void *grow (void *p, size_t cnt, size_t size)
+{
+  p = realloc (p, cnt * size);
+  if (p == NULL)
+    {
+      fprintf (stderr, "contact: out of memory\n");
+      exit (1);
+    }
+  return p;
+}
@@ -0,0 +1,87 @@
+#ifndef CONTACT_H
+#define CONTACT_H
+#include <stddef.h>
+#include <stdint.h>
+#include "body.h"
+#include "spatial_grid.h"
+
+/* Contact solver.
+
+   Overlapping pairs among the broad-phase candidates become
+   contacts, each with an accumulated normal impulse that pushes
+   its two bodies apart.  Pairs with a massless body are left out,
+   as such a tracer takes no impulse.  Rather than resolving every pair once in
+   turn, which in a dense clump pushes bodies into their
+   neighbours, the solver sweeps over the contacts up to ITERATIONS
+   times (projected Gauss-Seidel).  Each visit moves the pair's
+   impulse towards the one that stops the approach, or reverses it
+   by the restitution, and clamps it so that contacts only ever
+   push.  Sweeping stops early once no visit changes a relative
+   velocity by more than CONTACT_TOLERANCE of the fastest approach
+   among the contacts.  Overlaps left
+   afterwards are pushed apart in mass-weighted position sweeps,
+   which keep the centre of mass of every pair in place, down to
+   CONTACT_SLOP of the pair's reach.  The slop keeps a resting pair
+   touching, so it is found again on the next step.
+
+   Contacts are cached from one step to the next by the handles of
+   their bodies.  A pair still touching starts from its last
+   impulse (warm starting), so a resting pile, whose impulses
+   hardly change between steps, converges in a sweep or two
+   instead of rebuilding its impulses from zero.  Only the last
+   step's contacts are kept. */
+
+#define CONTACT_TOLERANCE 1e-3    /* Velocity change ending the sweeps. */
+#define CONTACT_SLOP .01          /* Overlap left, relative to the reach. */
+
+/* Contact of the current step. */
+struct contact
+{
+  uint32_t a;                 /* Body indices. */
+  uint32_t b;
+  double nx;                  /* Unit normal, from B towards A. */
+  double ny;
+  double mass;                /* Effective mass along the normal. */
+  double target;              /* Normal velocity to reach. */
+  double impulse;             /* Accumulated normal impulse. */
+};
+
+/* Cached impulse of the pair of bodies A and B, A < B.  Unused
+   entries have A == B. */
+struct contact_entry
+{
+  body_handle a;
+  body_handle b;
+  double impulse;
+};
+
+/* Contact solver. */
+struct contact_solver
+{
+  int iterations;             /* Most sweeps per pass. */
+  double restitution;         /* Share of the approach speed bounced. */
+
+  struct contact *contacts;   /* Of the last pass. */
+  size_t cnt;
+  size_t cap;
+
+  struct contact_entry *cache;  /* Hash table, CACHE_CAP a power */
+  size_t cache_cnt;             /* of two or 0. */
+  size_t cache_cap;
+
+  /* Counters of the last pass */
+  size_t warm_started;        /* Contacts found in the cache. */
+  size_t sweeps;              /* Velocity and position sweeps. */
+  size_t visits;              /* Contact updates in all sweeps. */
+  size_t corrections;         /* Overlaps pushed apart. */
+};
+
+void contact_solver_init (struct contact_solver *);
+void contact_solver_destroy (struct contact_solver *);
+void contact_solver_clear (struct contact_solver *);
+void contact_solve (struct contact_solver *, struct body_store *,
+                    const struct grid_pair *, size_t pair_cnt);
+void contact_cache_put (struct contact_solver *, body_handle a,
+                        body_handle b, double impulse);
+
+#endif /* contact.h */
@@ -0,0 +1,928 @@
+#include "gravity.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if (defined (__x86_64__) || defined (__i386__)) && defined (__GNUC__)
+#define GRAVITY_X86 1
+#include <immintrin.h>
+#define TARGET(ISA) __attribute__ ((target (ISA)))
+#else
+#define GRAVITY_X86 0
+#endif
+
+/* Computes the acceleration of bodies BEGIN..END (exclusive). */
+typedef void gravity_kernel (const struct gravity_ctx *, size_t begin,
+                             size_t end, double *ax, double *ay);
+
+#define INLINE inline __attribute__ ((always_inline))
+
+/* Sources summed in float before the float kernels add their
+   partial sums into double, so that rounding does not grow with
+   the body count. */
+#define F32_BLOCK 1024
+
+/* Declares the instances of kernel NAME, one per softening law,
+   and lists them in law order. */
+#define DECLARE(NAME)                                   \
+  static gravity_kernel NAME##_none;                    \
+  static gravity_kernel NAME##_plummer;                 \
+  static gravity_kernel NAME##_spline;
+#define LAWS(NAME) { NAME##_none, NAME##_plummer, NAME##_spline }
+
+DECLARE (accel_scalar_f64)
+DECLARE (accel_scalar_f32)
+#if GRAVITY_X86
+DECLARE (accel_sse2_f64)
+DECLARE (accel_sse2_f32)
+DECLARE (accel_avx2_f64)
+DECLARE (accel_avx2_f32)
+DECLARE (accel_avx512_f64)
+DECLARE (accel_avx512_f32)
+#endif
+
+/* Kernels indexed by instruction set, precision and softening
+   law. */
+static gravity_kernel *const kernels[GRAVITY_ISA_CNT][2][GRAVITY_SOFT_CNT] =
+{
+  { LAWS (accel_scalar_f64), LAWS (accel_scalar_f32) },
+#if GRAVITY_X86
+  { LAWS (accel_sse2_f64), LAWS (accel_sse2_f32) },
+  { LAWS (accel_avx2_f64), LAWS (accel_avx2_f32) },
+  { LAWS (accel_avx512_f64), LAWS (accel_avx512_f32) },
+#else
+  { LAWS (accel_scalar_f64), LAWS (accel_scalar_f32) },
+  { LAWS (accel_scalar_f64), LAWS (accel_scalar_f32) },
+  { LAWS (accel_scalar_f64), LAWS (accel_scalar_f32) },
+#endif
+};
+
+static enum gravity_isa max_isa = GRAVITY_ISA_SCALAR;
+static enum gravity_isa cur_isa = GRAVITY_ISA_SCALAR;
+
+/* Detects the widest instruction set the CPU supports and selects
+   it. */
+void gravity_init (void)
+{
+  max_isa = GRAVITY_ISA_SCALAR;
+#if GRAVITY_X86
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("sse2"))
+    max_isa = GRAVITY_ISA_SSE2;
+  if (__builtin_cpu_supports ("avx2") && __builtin_cpu_supports ("fma"))
+    max_isa = GRAVITY_ISA_AVX2;
+  if (__builtin_cpu_supports ("avx512f"))
+    max_isa = GRAVITY_ISA_AVX512;
+#endif
+  cur_isa = max_isa;
+}
+
+/* Returns the selected instruction set. */
+enum gravity_isa gravity_get_isa (void)
+{
+  return cur_isa;
+}
+
+/* Returns the widest instruction set the CPU supports. */
+enum gravity_isa gravity_max_isa (void)
+{
+  return max_isa;
+}
+
+/* Selects instruction set ISA, or the widest supported one if ISA
+   is not available. */
+void gravity_set_isa (enum gravity_isa isa)
+{
+  cur_isa = (isa > max_isa) ? max_isa : isa;
+}
+
+/* Returns the name of ISA. */
+const char *gravity_isa_name (enum gravity_isa isa)
+{
+  switch (isa)
+    {
+      case GRAVITY_ISA_SCALAR: return "scalar";
+      case GRAVITY_ISA_SSE2: return "sse2";
+      case GRAVITY_ISA_AVX2: return "avx2";
+      case GRAVITY_ISA_AVX512: return "avx512";
+      default: return "?";
+    }
+}
+
+/* Initializes G for PRECISION. */
+void gravity_ctx_init (struct gravity_ctx *g, enum gravity_precision precision)
+{
+  assert (g != NULL);
+  g->bodies = NULL;
+  g->precision = precision;
+  g->pos_x = NULL;
+  g->pos_y = NULL;
+  g->mass = NULL;
+  g->cap = 0;
+  gravity_set_softening (g, GRAVITY_SOFT_NONE, 0);
+  g->part_x = NULL;
+  g->part_y = NULL;
+  g->worker_cnt = 0;
+  g->part_cap = 0;
+}
+
+/* Frees the memory held by G. */
+void gravity_ctx_destroy (struct gravity_ctx *g)
+{
+  assert (g != NULL);
+  free (g->pos_x);
+  free (g->pos_y);
+  free (g->mass);
+  free (g->part_x);
+  free (g->part_y);
+  enum gravity_softening softening = g->softening;
+  double eps = g->eps;
+  gravity_ctx_init (g, g->precision);
+  gravity_set_softening (g, softening, eps);
+}
+
+/* Makes G soften pairs with law SOFTENING and length EPS.  A
+   softening law with EPS <= 0 falls back to the plain law. */
+void gravity_set_softening (struct gravity_ctx *g,
+                            enum gravity_softening softening, double eps)
+{
+  if (eps <= 0 || softening >= GRAVITY_SOFT_CNT)
+    {
+      softening = GRAVITY_SOFT_NONE;
+      eps = 0;
+    }
+  g->softening = softening;
+  g->eps = eps;
+  g->eps2 = eps * eps;
+  g->inv_eps4 = (eps > 0) ? 1 / (g->eps2 * g->eps2) : 0;
+}
+
+/* Returns the name of SOFTENING. */
+const char *gravity_softening_name (enum gravity_softening softening)
+{
+  switch (softening)
+    {
+      case GRAVITY_SOFT_NONE: return "none";
+      case GRAVITY_SOFT_PLUMMER: return "plummer";
+      case GRAVITY_SOFT_SPLINE: return "spline";
+      default: return "?";
+    }
+}
+
+/* Points G at BODIES for the coming gravity_accel() calls.  Must be
+   called again whenever BODIES moves. */
+void gravity_prepare (struct gravity_ctx *g, const struct body_store *bodies)
+{
+  g->bodies = bodies;
+  if (g->precision != GRAVITY_FLOAT)
+    return;
+
+  size_t cnt = bodies->cnt;
+  if (g->cap < cnt)
+    {
+      free (g->pos_x);
+      free (g->pos_y);
+      free (g->mass);
+      g->pos_x = malloc (cnt * sizeof *g->pos_x);
+      g->pos_y = malloc (cnt * sizeof *g->pos_y);
+      g->mass = malloc (cnt * sizeof *g->mass);
+      if (g->pos_x == NULL || g->pos_y == NULL || g->mass == NULL)
+        {
+          fprintf (stderr, "gravity: out of memory\n");
+          exit (1);
+        }
+      g->cap = cnt;
+    }
+
+  for (size_t i = 0; i < cnt; i++)
+    {
+      g->pos_x[i] = bodies->pos_x[i];
+      g->pos_y[i] = bodies->pos_y[i];
+      g->mass[i] = bodies->mass[i];
+    }
+}
+
+/* Stores in AX[I] and AY[I] the acceleration of body I, for I in
+   BEGIN..END (exclusive), due to all bodies prepared in G. */
+void gravity_accel (const struct gravity_ctx *g, size_t begin, size_t end,
+                    double *ax, double *ay)
+{
+  assert (g->bodies != NULL);
+  kernels[cur_isa][g->precision][g->softening] (g, begin, end, ax, ay);
+}
+
+/* Returns the number of folded row pairs gravity_pairs() splits
+   the bodies prepared in G into. */
+size_t gravity_pair_rows (const struct gravity_ctx *g)
+{
+  return (g->bodies->cnt + 1) / 2;
+}
+
+/* Points G at BODIES for the coming gravity_pairs() calls by up
+   to WORKER_CNT workers and clears their partial sums.  Must be
+   called before every pass. */
+void gravity_prepare_pairs (struct gravity_ctx *g,
+                            const struct body_store *bodies, int worker_cnt)
+{
+  size_t need = (size_t) worker_cnt * bodies->cnt;
+
+  g->bodies = bodies;
+  g->worker_cnt = worker_cnt;
+  if (g->part_cap < need)
+    {
+      free (g->part_x);
+      free (g->part_y);
+      g->part_x = malloc (need * sizeof *g->part_x);
+      g->part_y = malloc (need * sizeof *g->part_y);
+      if (g->part_x == NULL || g->part_y == NULL)
+        {
+          fprintf (stderr, "gravity: out of memory\n");
+          exit (1);
+        }
+      g->part_cap = need;
+    }
+  memset (g->part_x, 0, need * sizeof *g->part_x);
+  memset (g->part_y, 0, need * sizeof *g->part_y);
+}
+
+/* Adds the pairs of body I with every body after I to the partial
+   sums SX, SY, softened as in G.  Returns the number of pairs. */
+static INLINE size_t pair_row (const struct gravity_ctx *g, size_t i,
+                               double *sx, double *sy,
+                               enum gravity_softening soft)
+{
+  const struct body_store *bodies = g->bodies;
+  const double *px = bodies->pos_x;
+  const double *py = bodies->pos_y;
+  const double *m = bodies->mass;
+  size_t cnt = bodies->cnt;
+  double xi = px[i], yi = py[i], mi = m[i];
+  double ax = 0, ay = 0;
+
+  for (size_t j = i + 1; j < cnt; j++)
+    {
+      double dx = px[j] - xi;
+      double dy = py[j] - yi;
+      double f = gravity_soft_factor (soft, dx * dx + dy * dy,
+                                      g->eps2, g->inv_eps4);
+      double si = m[j] * f;
+      double sj = mi * f;
+      ax += si * dx;
+      ay += si * dy;
+      sx[j] -= sj * dx;
+      sy[j] -= sj * dy;
+    }
+  sx[i] += ax;
+  sy[i] += ay;
+  return cnt - 1 - i;
+}
+
+/* Body of gravity_pairs(), specialised on SOFT. */
+static INLINE uint64_t pair_rows (const struct gravity_ctx *g, size_t begin,
+                                  size_t end, int worker,
+                                  enum gravity_softening soft)
+{
+  size_t cnt = g->bodies->cnt;
+  double *sx = g->part_x + (size_t) worker * cnt;
+  double *sy = g->part_y + (size_t) worker * cnt;
+  uint64_t pairs = 0;
+
+  for (size_t k = begin; k < end; k++)
+    {
+      pairs += pair_row (g, k, sx, sy, soft);
+      if (cnt - 1 - k != k)
+        pairs += pair_row (g, cnt - 1 - k, sx, sy, soft);
+    }
+  return pairs;
+}
+
+/* Accumulates, as worker WORKER, the pairs of folded row pairs
+   BEGIN..END (exclusive) into that worker's partial sums.
+   Returns the number of pairs visited. */
+uint64_t gravity_pairs (const struct gravity_ctx *g, size_t begin,
+                        size_t end, int worker)
+{
+  assert (g->bodies != NULL && worker < g->worker_cnt);
+  switch (g->softening)
+    {
+      case GRAVITY_SOFT_PLUMMER:
+        return pair_rows (g, begin, end, worker, GRAVITY_SOFT_PLUMMER);
+      case GRAVITY_SOFT_SPLINE:
+        return pair_rows (g, begin, end, worker, GRAVITY_SOFT_SPLINE);
+      default:
+        return pair_rows (g, begin, end, worker, GRAVITY_SOFT_NONE);
+    }
+}
+
+/* Stores in AX[I] and AY[I] the sum of all workers' partial sums
+   for body I, for I in BEGIN..END (exclusive). */
+void gravity_reduce (const struct gravity_ctx *g, size_t begin, size_t end,
+                     double *ax, double *ay)
+{
+  size_t cnt = g->bodies->cnt;
+
+  for (size_t i = begin; i < end; i++)
+    {
+      double sx = 0, sy = 0;
+      for (int w = 0; w < g->worker_cnt; w++)
+        {
+          sx += g->part_x[(size_t) w * cnt + i];
+          sy += g->part_y[(size_t) w * cnt + i];
+        }
+      ax[i] = sx;
+      ay[i] = sy;
+    }
+}
+
+/* Scalar kernels.  Also used for the tails of the vector loops.
+
+   Every kernel is written once as an always-inlined body taking
+   the softening law as an argument, and instantiated below for
+   each law with a constant, so the compiler drops the switch and
+   the pair loops carry no branch. */
+
+/* Instantiates gravity_kernel NAME_none, NAME_plummer and
+   NAME_spline from body NAME, with function attributes ATTR. */
+#define INSTANTIATE(NAME, ATTR)                                         \
+  ATTR static void NAME##_none (const struct gravity_ctx *g,            \
+                                size_t begin, size_t end,               \
+                                double *ax, double *ay)                 \
+  { NAME (g, begin, end, ax, ay, GRAVITY_SOFT_NONE); }                  \
+  ATTR static void NAME##_plummer (const struct gravity_ctx *g,         \
+                                   size_t begin, size_t end,            \
+                                   double *ax, double *ay)              \
+  { NAME (g, begin, end, ax, ay, GRAVITY_SOFT_PLUMMER); }               \
+  ATTR static void NAME##_spline (const struct gravity_ctx *g,          \
+                                  size_t begin, size_t end,             \
+                                  double *ax, double *ay)               \
+  { NAME (g, begin, end, ax, ay, GRAVITY_SOFT_SPLINE); }
+
+static INLINE void pair_f64 (double xi, double yi, double xj, double yj,
+                             double mj, enum gravity_softening soft,
+                             double eps2, double inv_eps4,
+                             double *sx, double *sy)
+{
+  double dx = xj - xi;
+  double dy = yj - yi;
+  double s = mj * gravity_soft_factor (soft, dx * dx + dy * dy,
+                                       eps2, inv_eps4);
+  *sx += s * dx;
+  *sy += s * dy;
+}
+
+static INLINE void pair_f32 (float xi, float yi, float xj, float yj,
+                             float mj, enum gravity_softening soft,
+                             float eps2, float inv_eps4,
+                             float *sx, float *sy)
+{
+  float dx = xj - xi;
+  float dy = yj - yi;
+  float r = dx * dx + dy * dy;
+  float f;
+  switch (soft)
+    {
+      case GRAVITY_SOFT_PLUMMER: f = 1.0f / (r + eps2); break;
+      case GRAVITY_SOFT_SPLINE:
+        f = (r < eps2) ? (2.0f * eps2 - r) * inv_eps4 : 1.0f / r;
+        break;
+      default: f = (r > 0.0f) ? 1.0f / r : 0.0f; break;
+    }
+  *sx += mj * f * dx;
+  *sy += mj * f * dy;
+}
+
+static INLINE void accel_scalar_f64 (const struct gravity_ctx *g,
+                                     size_t begin, size_t end,
+                                     double *ax, double *ay,
+                                     enum gravity_softening soft)
+{
+  const double *px = g->bodies->pos_x;
+  const double *py = g->bodies->pos_y;
+  const double *m = g->bodies->mass;
+  size_t cnt = g->bodies->cnt;
+  double eps2 = g->eps2, inv_eps4 = g->inv_eps4;
+
+  for (size_t i = begin; i < end; i++)
+    {
+      double sx = 0, sy = 0;
+      for (size_t j = 0; j < cnt; j++)
+        pair_f64 (px[i], py[i], px[j], py[j], m[j], soft, eps2, inv_eps4,
+                  &sx, &sy);
+      ax[i] = sx;
+      ay[i] = sy;
+    }
+}
+INSTANTIATE (accel_scalar_f64, )
+
+static INLINE void accel_scalar_f32 (const struct gravity_ctx *g,
+                                     size_t begin, size_t end,
+                                     double *ax, double *ay,
+                                     enum gravity_softening soft)
+{
+  const float *px = g->pos_x;
+  const float *py = g->pos_y;
+  const float *m = g->mass;
+  size_t cnt = g->bodies->cnt;
+  float eps2 = g->eps2, inv_eps4 = g->inv_eps4;
+
+  for (size_t i = begin; i < end; i++)
+    {
+      double acc_x = 0, acc_y = 0;
+      for (size_t jb = 0; jb < cnt; jb += F32_BLOCK)
+        {
+          size_t je = (cnt - jb < F32_BLOCK) ? cnt : jb + F32_BLOCK;
+          float sx = 0.0f, sy = 0.0f;
+          for (size_t j = jb; j < je; j++)
+            pair_f32 (px[i], py[i], px[j], py[j], m[j], soft, eps2,
+                      inv_eps4, &sx, &sy);
+          acc_x += sx;
+          acc_y += sy;
+        }
+      ax[i] = acc_x;
+      ay[i] = acc_y;
+    }
+}
+INSTANTIATE (accel_scalar_f32, )
+
+#if GRAVITY_X86
+
+/* SSE2: 2 doubles or 4 floats per iteration. */
+
+TARGET ("sse2")
+static double hsum_sse2_pd (__m128d v)
+{
+  return _mm_cvtsd_f64 (_mm_add_sd (v, _mm_unpackhi_pd (v, v)));
+}
+
+TARGET ("sse2")
+static double hsum_sse2_ps (__m128 v)
+{
+  __m128d lo = _mm_cvtps_pd (v);
+  __m128d hi = _mm_cvtps_pd (_mm_movehl_ps (v, v));
+  return hsum_sse2_pd (_mm_add_pd (lo, hi));
+}
+
+/* Returns M times the softened 1/r² factor at squared distance R.
+   SSE2 has no blend, so selections are done with and/andnot. */
+TARGET ("sse2")
+static INLINE __m128d soft_sse2_pd (__m128d m, __m128d r,
+                                    enum gravity_softening soft,
+                                    __m128d eps2, __m128d inv_eps4)
+{
+  switch (soft)
+    {
+      case GRAVITY_SOFT_PLUMMER:
+        return _mm_div_pd (m, _mm_add_pd (r, eps2));
+      case GRAVITY_SOFT_SPLINE:
+        {
+          __m128d in = _mm_cmplt_pd (r, eps2);
+          __m128d near = _mm_mul_pd (m, _mm_mul_pd (
+                           _mm_sub_pd (_mm_add_pd (eps2, eps2), r), inv_eps4));
+          __m128d far = _mm_div_pd (m, r);
+          return _mm_or_pd (_mm_and_pd (in, near), _mm_andnot_pd (in, far));
+        }
+      default:
+        return _mm_and_pd (_mm_div_pd (m, r),
+                           _mm_cmpgt_pd (r, _mm_setzero_pd ()));
+    }
+}
+
+TARGET ("sse2")
+static INLINE __m128 soft_sse2_ps (__m128 m, __m128 r,
+                                   enum gravity_softening soft,
+                                   __m128 eps2, __m128 inv_eps4)
+{
+  __m128 two = _mm_set1_ps (2.0f);
+
+  /* 1/x: 12-bit estimate plus one Newton-Raphson step. */
+  __m128 x = (soft == GRAVITY_SOFT_PLUMMER) ? _mm_add_ps (r, eps2) : r;
+  __m128 inv = _mm_rcp_ps (x);
+  inv = _mm_mul_ps (inv, _mm_sub_ps (two, _mm_mul_ps (x, inv)));
+
+  switch (soft)
+    {
+      case GRAVITY_SOFT_PLUMMER:
+        return _mm_mul_ps (m, inv);
+      case GRAVITY_SOFT_SPLINE:
+        {
+          __m128 in = _mm_cmplt_ps (r, eps2);
+          __m128 near = _mm_mul_ps (_mm_sub_ps (_mm_add_ps (eps2, eps2), r),
+                                    inv_eps4);
+          inv = _mm_or_ps (_mm_and_ps (in, near), _mm_andnot_ps (in, inv));
+          return _mm_mul_ps (m, inv);
+        }
+      default:
+        return _mm_and_ps (_mm_mul_ps (m, inv),
+                           _mm_cmpgt_ps (r, _mm_setzero_ps ()));
+    }
+}
+
+TARGET ("sse2")
+static INLINE void accel_sse2_f64 (const struct gravity_ctx *g,
+                                   size_t begin, size_t end,
+                                   double *ax, double *ay,
+                                   enum gravity_softening soft)
+{
+  const double *px = g->bodies->pos_x;
+  const double *py = g->bodies->pos_y;
+  const double *m = g->bodies->mass;
+  size_t cnt = g->bodies->cnt;
+  size_t vec_cnt = cnt & ~(size_t) 1;
+  __m128d zero = _mm_setzero_pd ();
+  __m128d eps2 = _mm_set1_pd (g->eps2);
+  __m128d inv_eps4 = _mm_set1_pd (g->inv_eps4);
+
+  for (size_t i = begin; i < end; i++)
+    {
+      __m128d xi = _mm_set1_pd (px[i]);
+      __m128d yi = _mm_set1_pd (py[i]);
+      __m128d sx = zero, sy = zero;
+      for (size_t j = 0; j < vec_cnt; j += 2)
+        {
+          __m128d dx = _mm_sub_pd (_mm_loadu_pd (px + j), xi);
+          __m128d dy = _mm_sub_pd (_mm_loadu_pd (py + j), yi);
+          __m128d r = _mm_add_pd (_mm_mul_pd (dx, dx), _mm_mul_pd (dy, dy));
+          __m128d s = soft_sse2_pd (_mm_loadu_pd (m + j), r, soft,
+                                    eps2, inv_eps4);
+          sx = _mm_add_pd (sx, _mm_mul_pd (s, dx));
+          sy = _mm_add_pd (sy, _mm_mul_pd (s, dy));
+        }
+      double acc_x = hsum_sse2_pd (sx), acc_y = hsum_sse2_pd (sy);
+      for (size_t j = vec_cnt; j < cnt; j++)
+        pair_f64 (px[i], py[i], px[j], py[j], m[j], soft, g->eps2,
+                  g->inv_eps4, &acc_x, &acc_y);
+      ax[i] = acc_x;
+      ay[i] = acc_y;
+    }
+}
+INSTANTIATE (accel_sse2_f64, TARGET ("sse2"))
+
+TARGET ("sse2")
+static INLINE void accel_sse2_f32 (const struct gravity_ctx *g,
+                                   size_t begin, size_t end,
+                                   double *ax, double *ay,
+                                   enum gravity_softening soft)
+{
+  const float *px = g->pos_x;
+  const float *py = g->pos_y;
+  const float *m = g->mass;
+  size_t cnt = g->bodies->cnt;
+  size_t vec_cnt = cnt & ~(size_t) 3;
+  __m128 zero = _mm_setzero_ps ();
+  __m128 eps2 = _mm_set1_ps (g->eps2);
+  __m128 inv_eps4 = _mm_set1_ps (g->inv_eps4);
+
+  for (size_t i = begin; i < end; i++)
+    {
+      __m128 xi = _mm_set1_ps (px[i]);
+      __m128 yi = _mm_set1_ps (py[i]);
+      double acc_x = 0, acc_y = 0;
+      for (size_t jb = 0; jb < vec_cnt; jb += F32_BLOCK)
+        {
+          size_t je = (vec_cnt - jb < F32_BLOCK) ? vec_cnt : jb + F32_BLOCK;
+          __m128 sx = zero, sy = zero;
+          for (size_t j = jb; j < je; j += 4)
+            {
+              __m128 dx = _mm_sub_ps (_mm_loadu_ps (px + j), xi);
+              __m128 dy = _mm_sub_ps (_mm_loadu_ps (py + j), yi);
+              __m128 r = _mm_add_ps (_mm_mul_ps (dx, dx),
+                                     _mm_mul_ps (dy, dy));
+              __m128 s = soft_sse2_ps (_mm_loadu_ps (m + j), r, soft,
+                                       eps2, inv_eps4);
+              sx = _mm_add_ps (sx, _mm_mul_ps (s, dx));
+              sy = _mm_add_ps (sy, _mm_mul_ps (s, dy));
+            }
+          acc_x += hsum_sse2_ps (sx);
+          acc_y += hsum_sse2_ps (sy);
+        }
+      float tail_x = 0.0f, tail_y = 0.0f;
+      for (size_t j = vec_cnt; j < cnt; j++)
+        pair_f32 (px[i], py[i], px[j], py[j], m[j], soft, g->eps2,
+                  g->inv_eps4, &tail_x, &tail_y);
+      ax[i] = acc_x + tail_x;
+      ay[i] = acc_y + tail_y;
+    }
+}
+INSTANTIATE (accel_sse2_f32, TARGET ("sse2"))
+
+/* AVX2 + FMA: 4 doubles or 8 floats per iteration. */
+
+TARGET ("avx2,fma")
+static double hsum_avx2_pd (__m256d v)
+{
+  __m128d lo = _mm256_castpd256_pd128 (v);
+  __m128d hi = _mm256_extractf128_pd (v, 1);
+  lo = _mm_add_pd (lo, hi);
+  return _mm_cvtsd_f64 (_mm_add_sd (lo, _mm_unpackhi_pd (lo, lo)));
+}
+
+TARGET ("avx2,fma")
+static double hsum_avx2_ps (__m256 v)
+{
+  __m256d lo = _mm256_cvtps_pd (_mm256_castps256_ps128 (v));
+  __m256d hi = _mm256_cvtps_pd (_mm256_extractf128_ps (v, 1));
+  return hsum_avx2_pd (_mm256_add_pd (lo, hi));
+}
+
+/* Returns M times the softened 1/r² factor at squared distance R. */
+TARGET ("avx2,fma")
+static INLINE __m256d soft_avx2_pd (__m256d m, __m256d r,
+                                    enum gravity_softening soft,
+                                    __m256d eps2, __m256d inv_eps4)
+{
+  switch (soft)
+    {
+      case GRAVITY_SOFT_PLUMMER:
+        return _mm256_div_pd (m, _mm256_add_pd (r, eps2));
+      case GRAVITY_SOFT_SPLINE:
+        {
+          __m256d in = _mm256_cmp_pd (r, eps2, _CMP_LT_OQ);
+          __m256d near = _mm256_mul_pd (m, _mm256_mul_pd (
+                           _mm256_sub_pd (_mm256_add_pd (eps2, eps2), r),
+                           inv_eps4));
+          return _mm256_blendv_pd (_mm256_div_pd (m, r), near, in);
+        }
+      default:
+        return _mm256_and_pd (_mm256_div_pd (m, r),
+                              _mm256_cmp_pd (r, _mm256_setzero_pd (),
+                                             _CMP_GT_OQ));
+    }
+}
+
+TARGET ("avx2,fma")
+static INLINE __m256 soft_avx2_ps (__m256 m, __m256 r,
+                                   enum gravity_softening soft,
+                                   __m256 eps2, __m256 inv_eps4)
+{
+  __m256 two = _mm256_set1_ps (2.0f);
+
+  /* 1/x: 12-bit estimate plus one Newton-Raphson step. */
+  __m256 x = (soft == GRAVITY_SOFT_PLUMMER) ? _mm256_add_ps (r, eps2) : r;
+  __m256 inv = _mm256_rcp_ps (x);
+  inv = _mm256_mul_ps (inv, _mm256_fnmadd_ps (x, inv, two));
+
+  switch (soft)
+    {
+      case GRAVITY_SOFT_PLUMMER:
+        return _mm256_mul_ps (m, inv);
+      case GRAVITY_SOFT_SPLINE:
+        {
+          __m256 in = _mm256_cmp_ps (r, eps2, _CMP_LT_OQ);
+          __m256 near = _mm256_mul_ps (_mm256_sub_ps (_mm256_add_ps (eps2, eps2),
+                                                      r), inv_eps4);
+          return _mm256_mul_ps (m, _mm256_blendv_ps (inv, near, in));
+        }
+      default:
+        return _mm256_and_ps (_mm256_mul_ps (m, inv),
+                              _mm256_cmp_ps (r, _mm256_setzero_ps (),
+                                             _CMP_GT_OQ));
+    }
+}
+
+TARGET ("avx2,fma")
+static INLINE void accel_avx2_f64 (const struct gravity_ctx *g,
+                                   size_t begin, size_t end,
+                                   double *ax, double *ay,
+                                   enum gravity_softening soft)
+{
+  const double *px = g->bodies->pos_x;
+  const double *py = g->bodies->pos_y;
+  const double *m = g->bodies->mass;
+  size_t cnt = g->bodies->cnt;
+  size_t vec_cnt = cnt & ~(size_t) 3;
+  __m256d zero = _mm256_setzero_pd ();
+  __m256d eps2 = _mm256_set1_pd (g->eps2);
+  __m256d inv_eps4 = _mm256_set1_pd (g->inv_eps4);
+
+  for (size_t i = begin; i < end; i++)
+    {
+      __m256d xi = _mm256_set1_pd (px[i]);
+      __m256d yi = _mm256_set1_pd (py[i]);
+      __m256d sx = zero, sy = zero;
+      for (size_t j = 0; j < vec_cnt; j += 4)
+        {
+          __m256d dx = _mm256_sub_pd (_mm256_loadu_pd (px + j), xi);
+          __m256d dy = _mm256_sub_pd (_mm256_loadu_pd (py + j), yi);
+          __m256d r = _mm256_fmadd_pd (dx, dx, _mm256_mul_pd (dy, dy));
+          __m256d s = soft_avx2_pd (_mm256_loadu_pd (m + j), r, soft,
+                                    eps2, inv_eps4);
+          sx = _mm256_fmadd_pd (s, dx, sx);
+          sy = _mm256_fmadd_pd (s, dy, sy);
+        }
+      double acc_x = hsum_avx2_pd (sx), acc_y = hsum_avx2_pd (sy);
+      for (size_t j = vec_cnt; j < cnt; j++)
+        pair_f64 (px[i], py[i], px[j], py[j], m[j], soft, g->eps2,
+                  g->inv_eps4, &acc_x, &acc_y);
+      ax[i] = acc_x;
+      ay[i] = acc_y;
+    }
+}
+INSTANTIATE (accel_avx2_f64, TARGET ("avx2,fma"))
+
+TARGET ("avx2,fma")
+static INLINE void accel_avx2_f32 (const struct gravity_ctx *g,
+                                   size_t begin, size_t end,
+                                   double *ax, double *ay,
+                                   enum gravity_softening soft)
+{
+  const float *px = g->pos_x;
+  const float *py = g->pos_y;
+  const float *m = g->mass;
+  size_t cnt = g->bodies->cnt;
+  size_t vec_cnt = cnt & ~(size_t) 7;
+  __m256 zero = _mm256_setzero_ps ();
+  __m256 eps2 = _mm256_set1_ps (g->eps2);
+  __m256 inv_eps4 = _mm256_set1_ps (g->inv_eps4);
+
+  for (size_t i = begin; i < end; i++)
+    {
+      __m256 xi = _mm256_set1_ps (px[i]);
+      __m256 yi = _mm256_set1_ps (py[i]);
+      double acc_x = 0, acc_y = 0;
+      for (size_t jb = 0; jb < vec_cnt; jb += F32_BLOCK)
+        {
+          size_t je = (vec_cnt - jb < F32_BLOCK) ? vec_cnt : jb + F32_BLOCK;
+          __m256 sx = zero, sy = zero;
+          for (size_t j = jb; j < je; j += 8)
+            {
+              __m256 dx = _mm256_sub_ps (_mm256_loadu_ps (px + j), xi);
+              __m256 dy = _mm256_sub_ps (_mm256_loadu_ps (py + j), yi);
+              __m256 r = _mm256_fmadd_ps (dx, dx, _mm256_mul_ps (dy, dy));
+              __m256 s = soft_avx2_ps (_mm256_loadu_ps (m + j), r, soft,
+                                       eps2, inv_eps4);
+              sx = _mm256_fmadd_ps (s, dx, sx);
+              sy = _mm256_fmadd_ps (s, dy, sy);
+            }
+          acc_x += hsum_avx2_ps (sx);
+          acc_y += hsum_avx2_ps (sy);
+        }
+      float tail_x = 0.0f, tail_y = 0.0f;
+      for (size_t j = vec_cnt; j < cnt; j++)
+        pair_f32 (px[i], py[i], px[j], py[j], m[j], soft, g->eps2,
+                  g->inv_eps4, &tail_x, &tail_y);
+      ax[i] = acc_x + tail_x;
+      ay[i] = acc_y + tail_y;
+    }
+}
+INSTANTIATE (accel_avx2_f32, TARGET ("avx2,fma"))
+
+/* AVX-512F: 8 doubles or 16 floats per iteration. */
+
+TARGET ("avx512f")
+static double hsum_avx512_ps (__m512 v)
+{
+  __m512d lo = _mm512_cvtps_pd (_mm512_castps512_ps256 (v));
+  __m512d hi = _mm512_cvtps_pd (_mm256_castpd_ps (
+                 _mm512_extractf64x4_pd (_mm512_castps_pd (v), 1)));
+  return _mm512_reduce_add_pd (_mm512_add_pd (lo, hi));
+}
+
+/* Returns M times the softened 1/r² factor at squared distance R. */
+TARGET ("avx512f")
+static INLINE __m512d soft_avx512_pd (__m512d m, __m512d r,
+                                      enum gravity_softening soft,
+                                      __m512d eps2, __m512d inv_eps4)
+{
+  switch (soft)
+    {
+      case GRAVITY_SOFT_PLUMMER:
+        return _mm512_div_pd (m, _mm512_add_pd (r, eps2));
+      case GRAVITY_SOFT_SPLINE:
+        {
+          __mmask8 in = _mm512_cmp_pd_mask (r, eps2, _CMP_LT_OQ);
+          __m512d near = _mm512_mul_pd (m, _mm512_mul_pd (
+                           _mm512_sub_pd (_mm512_add_pd (eps2, eps2), r),
+                           inv_eps4));
+          return _mm512_mask_div_pd (near, ~in, m, r);
+        }
+      default:
+        {
+          __mmask8 k = _mm512_cmp_pd_mask (r, _mm512_setzero_pd (),
+                                           _CMP_GT_OQ);
+          return _mm512_maskz_div_pd (k, m, r);
+        }
+    }
+}
+
+TARGET ("avx512f")
+static INLINE __m512 soft_avx512_ps (__m512 m, __m512 r,
+                                     enum gravity_softening soft,
+                                     __m512 eps2, __m512 inv_eps4)
+{
+  __m512 two = _mm512_set1_ps (2.0f);
+
+  /* 1/x: 14-bit estimate plus one Newton-Raphson step. */
+  __m512 x = (soft == GRAVITY_SOFT_PLUMMER) ? _mm512_add_ps (r, eps2) : r;
+  __m512 inv = _mm512_rcp14_ps (x);
+  inv = _mm512_mul_ps (inv, _mm512_fnmadd_ps (x, inv, two));
+
+  switch (soft)
+    {
+      case GRAVITY_SOFT_PLUMMER:
+        return _mm512_mul_ps (m, inv);
+      case GRAVITY_SOFT_SPLINE:
+        {
+          __mmask16 in = _mm512_cmp_ps_mask (r, eps2, _CMP_LT_OQ);
+          __m512 near = _mm512_mul_ps (_mm512_sub_ps (_mm512_add_ps (eps2, eps2),
+                                                      r), inv_eps4);
+          return _mm512_mul_ps (m, _mm512_mask_blend_ps (in, inv, near));
+        }
+      default:
+        {
+          __mmask16 k = _mm512_cmp_ps_mask (r, _mm512_setzero_ps (),
+                                            _CMP_GT_OQ);
+          return _mm512_maskz_mul_ps (k, m, inv);
+        }
+    }
+}
+
+TARGET ("avx512f")
+static INLINE void accel_avx512_f64 (const struct gravity_ctx *g,
+                                     size_t begin, size_t end,
+                                     double *ax, double *ay,
+                                     enum gravity_softening soft)
+{
+  const double *px = g->bodies->pos_x;
+  const double *py = g->bodies->pos_y;
+  const double *m = g->bodies->mass;
+  size_t cnt = g->bodies->cnt;
+  size_t vec_cnt = cnt & ~(size_t) 7;
+  __m512d zero = _mm512_setzero_pd ();
+  __m512d eps2 = _mm512_set1_pd (g->eps2);
+  __m512d inv_eps4 = _mm512_set1_pd (g->inv_eps4);
+
+  for (size_t i = begin; i < end; i++)
+    {
+      __m512d xi = _mm512_set1_pd (px[i]);
+      __m512d yi = _mm512_set1_pd (py[i]);
+      __m512d sx = zero, sy = zero;
+      for (size_t j = 0; j < vec_cnt; j += 8)
+        {
+          __m512d dx = _mm512_sub_pd (_mm512_loadu_pd (px + j), xi);
+          __m512d dy = _mm512_sub_pd (_mm512_loadu_pd (py + j), yi);
+          __m512d r = _mm512_fmadd_pd (dx, dx, _mm512_mul_pd (dy, dy));
+          __m512d s = soft_avx512_pd (_mm512_loadu_pd (m + j), r, soft,
+                                      eps2, inv_eps4);
+          sx = _mm512_fmadd_pd (s, dx, sx);
+          sy = _mm512_fmadd_pd (s, dy, sy);
+        }
+      double acc_x = _mm512_reduce_add_pd (sx);
+      double acc_y = _mm512_reduce_add_pd (sy);
+      for (size_t j = vec_cnt; j < cnt; j++)
+        pair_f64 (px[i], py[i], px[j], py[j], m[j], soft, g->eps2,
+                  g->inv_eps4, &acc_x, &acc_y);
+      ax[i] = acc_x;
+      ay[i] = acc_y;
+    }
+}
+INSTANTIATE (accel_avx512_f64, TARGET ("avx512f"))
+
+TARGET ("avx512f")
+static INLINE void accel_avx512_f32 (const struct gravity_ctx *g,
+                                     size_t begin, size_t end,
+                                     double *ax, double *ay,
+                                     enum gravity_softening soft)
+{
+  const float *px = g->pos_x;
+  const float *py = g->pos_y;
+  const float *m = g->mass;
+  size_t cnt = g->bodies->cnt;
+  size_t vec_cnt = cnt & ~(size_t) 15;
+  __m512 zero = _mm512_setzero_ps ();
+  __m512 eps2 = _mm512_set1_ps (g->eps2);
+  __m512 inv_eps4 = _mm512_set1_ps (g->inv_eps4);
+
+  for (size_t i = begin; i < end; i++)
+    {
+      __m512 xi = _mm512_set1_ps (px[i]);
+      __m512 yi = _mm512_set1_ps (py[i]);
+      double acc_x = 0, acc_y = 0;
+      for (size_t jb = 0; jb < vec_cnt; jb += F32_BLOCK)
+        {
+          size_t je = (vec_cnt - jb < F32_BLOCK) ? vec_cnt : jb + F32_BLOCK;
+          __m512 sx = zero, sy = zero;
+          for (size_t j = jb; j < je; j += 16)
+            {
+              __m512 dx = _mm512_sub_ps (_mm512_loadu_ps (px + j), xi);
+              __m512 dy = _mm512_sub_ps (_mm512_loadu_ps (py + j), yi);
+              __m512 r = _mm512_fmadd_ps (dx, dx, _mm512_mul_ps (dy, dy));
+              __m512 s = soft_avx512_ps (_mm512_loadu_ps (m + j), r, soft,
+                                         eps2, inv_eps4);
+              sx = _mm512_fmadd_ps (s, dx, sx);
+              sy = _mm512_fmadd_ps (s, dy, sy);
+            }
+          acc_x += hsum_avx512_ps (sx);
+          acc_y += hsum_avx512_ps (sy);
+        }
+      float tail_x = 0.0f, tail_y = 0.0f;
+      for (size_t j = vec_cnt; j < cnt; j++)
+        pair_f32 (px[i], py[i], px[j], py[j], m[j], soft, g->eps2,
+                  g->inv_eps4, &tail_x, &tail_y);
+      ax[i] = acc_x + tail_x;
+      ay[i] = acc_y + tail_y;
+    }
+}
+INSTANTIATE (accel_avx512_f32, TARGET ("avx512f"))
+
+#endif /* GRAVITY_X86 */
@@ -0,0 +1,250 @@
+#include "ic.h"
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+#include "rng.h"
+
+/* Generator job shared by the workers. */
+struct ic_job
+{
+  struct body_store *bodies;
+  uint64_t seed;
+};
+
+/* Origin of every model. */
+#define IC_CENTER_X (CENTER_X)
+#define IC_CENTER_Y (CENTER_Y)
+
+static void uniform_task (void *job_, size_t begin, size_t end, int worker);
+static void plummer_task (void *job_, size_t begin, size_t end, int worker);
+static void disk_task (void *job_, size_t begin, size_t end, int worker);
+static void collapse_task (void *job_, size_t begin, size_t end, int worker);
+static void lattice_task (void *job_, size_t begin, size_t end, int worker);
+static void galaxies_task (void *job_, size_t begin, size_t end, int worker);
+static void disk_body (struct rng *r, size_t n, double *x, double *y,
+                       double *vx, double *vy);
+static void gaussian (struct rng *r, double *a, double *b);
+static void place (struct body_store *b, size_t i, double x, double y,
+                   double vx, double vy, double mass, Color color);
+
+/* Models, by enum ic_model. */
+static const struct ic_model_info
+{
+  const char *name;
+  thread_pool_task *task;
+}
+models[IC_CNT] =
+{
+  [IC_UNIFORM] = {"uniform", uniform_task},
+  [IC_PLUMMER] = {"plummer", plummer_task},
+  [IC_DISK] = {"disk", disk_task},
+  [IC_COLLAPSE] = {"collapse", collapse_task},
+  [IC_LATTICE] = {"lattice", lattice_task},
+  [IC_GALAXIES] = {"galaxies", galaxies_task},
+};
+
+/* Fills every body of BODIES from MODEL with random SEED, using
+   the threads of POOL. */
+void ic_generate (struct body_store *bodies, enum ic_model model,
+                  uint64_t seed, struct thread_pool *pool)
+{
+  assert (model < IC_CNT);
+  struct ic_job job = {bodies, seed};
+  thread_pool_run (pool, bodies->cnt, models[model].task, &job);
+}
+
+/* Returns the name of MODEL. */
+const char *ic_model_name (enum ic_model model)
+{
+  return (model < IC_CNT) ? models[model].name : "?";
+}
+
+/* Returns the model called NAME, or IC_CNT if there is none. */
+enum ic_model ic_model_by_name (const char *name)
+{
+  enum ic_model model;
+  for (model = 0; model < IC_CNT; model++)
+    if (strcmp (name, models[model].name) == 0)
+      break;
+  return model;
+}
+
+/* The original spawn: bodies at rest, spread over a square of half
+   width 5 N, the last 1% five times as heavy as the rest. */
+static void uniform_task (void *job_, size_t begin, size_t end, int worker)
+{
+  struct ic_job *job = job_;
+  struct body_store *b = job->bodies;
+  size_t heavy_from = b->cnt - (size_t) (b->cnt * .01);
+  double range = 5.0 * b->cnt;
+
+  for (size_t i = begin; i < end; i++)
+    {
+      struct rng r = rng_stream (job->seed, RNG_INITIAL_CONDITIONS, i);
+      double x = (2 * rng_uniform (&r) - 1) * range;
+      double y = (2 * rng_uniform (&r) - 1) * range;
+      place (b, i, x, y, 0, 0, (i >= heavy_from) ? 5 * IC_MASS : IC_MASS,
+             RAYWHITE);
+    }
+}
+
+/* Plummer sphere projected onto the plane: surface density
+   (1 + R²/a²)^-2, so the mass inside R is M R² / (R² + a²).
+   Velocities are isotropic Gaussians.  With forces m d / |d|² the
+   virial is -M²/2 whatever the size, so a dispersion of M/4 per
+   component puts the system in virial equilibrium. */
+static void plummer_task (void *job_, size_t begin, size_t end, int worker)
+{
+  struct ic_job *job = job_;
+  struct body_store *b = job->bodies;
+  double a = IC_SCALE * sqrt ((double) b->cnt);
+  double sigma = sqrt (IC_MASS * (double) b->cnt / 4);
+
+  for (size_t i = begin; i < end; i++)
+    {
+      struct rng r = rng_stream (job->seed, RNG_INITIAL_CONDITIONS, i);
+      double u = rng_uniform (&r) * .999;
+      double rad = a * sqrt (u / (1 - u));
+      double phi = 2 * M_PI * rng_uniform (&r);
+      double vx, vy;
+      gaussian (&r, &vx, &vy);
+      place (b, i, rad * cos (phi), rad * sin (phi), sigma * vx, sigma * vy,
+             IC_MASS, RAYWHITE);
+    }
+}
+
+/* Exponential disk of all bodies, see disk_body(). */
+static void disk_task (void *job_, size_t begin, size_t end, int worker)
+{
+  struct ic_job *job = job_;
+  struct body_store *b = job->bodies;
+
+  for (size_t i = begin; i < end; i++)
+    {
+      struct rng r = rng_stream (job->seed, RNG_INITIAL_CONDITIONS, i);
+      double x, y, vx, vy;
+      disk_body (&r, b->cnt, &x, &y, &vx, &vy);
+      place (b, i, x, y, vx, vy, IC_MASS, RAYWHITE);
+    }
+}
+
+/* Cold collapse: a uniform disk at rest, which falls in on itself
+   within about one crossing time. */
+static void collapse_task (void *job_, size_t begin, size_t end, int worker)
+{
+  struct ic_job *job = job_;
+  struct body_store *b = job->bodies;
+  double a = IC_SCALE * sqrt ((double) b->cnt);
+
+  for (size_t i = begin; i < end; i++)
+    {
+      struct rng r = rng_stream (job->seed, RNG_INITIAL_CONDITIONS, i);
+      double rad = a * sqrt (rng_uniform (&r));
+      double phi = 2 * M_PI * rng_uniform (&r);
+      place (b, i, rad * cos (phi), rad * sin (phi), 0, 0, IC_MASS, RAYWHITE);
+    }
+}
+
+/* Bodies at rest on a square lattice filling -A..A in both axes,
+   each moved by up to a quarter of the spacing in either axis. */
+static void lattice_task (void *job_, size_t begin, size_t end, int worker)
+{
+  struct ic_job *job = job_;
+  struct body_store *b = job->bodies;
+  double a = IC_SCALE * sqrt ((double) b->cnt);
+  size_t side = (size_t) ceil (sqrt ((double) b->cnt));
+  double spacing = 2 * a / side;
+
+  for (size_t i = begin; i < end; i++)
+    {
+      struct rng r = rng_stream (job->seed, RNG_INITIAL_CONDITIONS, i);
+      double x = -a + (i % side + .5 + (rng_uniform (&r) - .5) / 2) * spacing;
+      double y = -a + (i / side + .5 + (rng_uniform (&r) - .5) / 2) * spacing;
+      place (b, i, x, y, 0, 0, IC_MASS, RAYWHITE);
+    }
+}
+
+/* Two exponential disks of half the bodies each, eight scale
+   lengths apart and offset by two, closing at half the circular
+   speed of their combined mass. */
+static void galaxies_task (void *job_, size_t begin, size_t end, int worker)
+{
+  struct ic_job *job = job_;
+  struct body_store *b = job->bodies;
+  size_t first = (b->cnt + 1) / 2;
+  double h = IC_SCALE * sqrt ((double) first) / 2;
+  double v = .5 * sqrt (IC_MASS * (double) b->cnt);
+
+  for (size_t i = begin; i < end; i++)
+    {
+      struct rng r = rng_stream (job->seed, RNG_INITIAL_CONDITIONS, i);
+      bool second = i >= first;
+      double sign = second ? 1 : -1;
+      double x, y, vx, vy;
+      disk_body (&r, second ? b->cnt - first : first, &x, &y, &vx, &vy);
+      place (b, i, x + sign * 4 * h, y + sign * h, vx - sign * v / 2, vy,
+             IC_MASS, second ? ORANGE : SKYBLUE);
+    }
+}
+
+/* Draws one body of an exponential disk of N bodies around the
+   origin: surface density exp (-R/h), with h half the scale
+   radius, cut off at ten scale lengths.  The mass inside R is
+   M (1 - (1 + x) e^-x) with x = R/h, which is inverted by Newton's
+   method.  The body moves counterclockwise at the circular speed
+   sqrt (M(<R)), with a 5% random component to keep the disk from
+   being perfectly cold. */
+static void disk_body (struct rng *r, size_t n, double *x, double *y,
+                       double *vx, double *vy)
+{
+  double h = IC_SCALE * sqrt ((double) n) / 2;
+  double mass = IC_MASS * (double) n;
+  double u = rng_uniform (r) * (1 - 11 * exp (-10.0));
+
+  double s = (u < .5) ? sqrt (2 * u) + 1e-9 : 1 - log (1 - u);
+  for (int k = 0; k < 32; k++)
+    {
+      double e = exp (-s);
+      double ds = (1 - (1 + s) * e - u) / (s * e);
+      s -= ds;
+      if (s <= 0)
+        s = 1e-9;
+      if (fabs (ds) < 1e-12 * s)
+        break;
+    }
+
+  double rad = s * h;
+  double vc = sqrt (mass * (1 - (1 + s) * exp (-s)));
+  double phi = 2 * M_PI * rng_uniform (r);
+  double c = cos (phi), sn = sin (phi);
+  double gx, gy;
+  gaussian (r, &gx, &gy);
+  *x = rad * c;
+  *y = rad * sn;
+  *vx = -vc * sn + .05 * vc * gx;
+  *vy = vc * c + .05 * vc * gy;
+}
+
+/* Draws two independent standard normal numbers into *A and *B. */
+static void gaussian (struct rng *r, double *a, double *b)
+{
+  double rad = sqrt (-2 * log (1 - rng_uniform (r)));
+  double phi = 2 * M_PI * rng_uniform (r);
+  *a = rad * cos (phi);
+  *b = rad * sin (phi);
+}
+
+/* Sets body I of B at X, Y from the origin of every model, with
+   velocity VX, VY, MASS and COLOR. */
+static void place (struct body_store *b, size_t i, double x, double y,
+                   double vx, double vy, double mass, Color color)
+{
+  b->pos_x[i] = IC_CENTER_X + x;
+  b->pos_y[i] = IC_CENTER_Y + y;
+  b->vel_x[i] = vx;
+  b->vel_y[i] = vy;
+  b->mass[i] = mass;
+  b->radius[i] = IC_RADIUS;
+  b->color[i] = color;
+}
@@ -0,0 +1,43 @@
+#ifndef IC_H
+#define IC_H
+#include <stddef.h>
+#include <stdint.h>
+#include "body.h"
+#include "thread_pool.h"
+
+/* Initial conditions.
+
+   Every generator fills a body store in place, in parallel on a
+   thread pool.  Body I draws its random numbers from its own
+   stream (see rng.h), so the result depends only on the model,
+   the count and the seed, never on the number of threads.
+
+   Forces are m d / |d|² (see gravity.h), so for a disk-symmetric
+   mass distribution a body at radius R feels the mass inside R as
+   if it sat at the centre: the circular speed is sqrt (M(<R)).
+   Models are laid out around the screen centre with a scale radius
+   of IC_SCALE sqrt (N), which keeps the mean density, and with it
+   the crossing time, independent of the body count. */
+
+#define IC_SCALE 25       /* Scale radius per square root of N. */
+#define IC_MASS 10        /* Mass of one body. */
+#define IC_RADIUS 10      /* Radius of one body. */
+
+enum ic_model
+{
+  IC_UNIFORM,           /* At rest in a square, 1% heavy bodies. */
+  IC_PLUMMER,           /* Projected Plummer sphere, virialised. */
+  IC_DISK,              /* Exponential disk on circular orbits. */
+  IC_COLLAPSE,          /* Uniform disk at rest. */
+  IC_LATTICE,           /* Square lattice with jitter, at rest. */
+  IC_GALAXIES,          /* Two exponential disks on a collision
+                           course. */
+  IC_CNT
+};
+
+void ic_generate (struct body_store *, enum ic_model, uint64_t seed,
+                  struct thread_pool *);
+const char *ic_model_name (enum ic_model);
+enum ic_model ic_model_by_name (const char *);
+
+#endif /* ic.h */
@@ -0,0 +1,330 @@
+#include "load.h"
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CSV_LINE_MAX 512          /* Longest CSV line. */
+#define COLUMN_CNT 6              /* Double columns of a column file. */
+
+/* Column file job shared by the workers. */
+struct columns_job
+{
+  struct body_store *bodies;
+  const unsigned char *base;  /* First column. */
+  size_t cnt;
+  bool swapped;
+  bool color;
+};
+
+/* CSV job shared by the workers. */
+struct csv_job
+{
+  struct body_store *bodies;
+  const char *text;
+  size_t size;
+  const size_t *lines;        /* Offset of the line of each body. */
+  size_t *bad;                /* Per worker: first bad body, or CNT. */
+};
+
+static bool load_columns (struct body_store *, const char *path,
+                          const unsigned char *map, size_t size,
+                          struct thread_pool *);
+static void columns_task (void *job_, size_t begin, size_t end, int worker);
+static bool load_csv (struct body_store *, const char *path,
+                      const char *text, size_t size, struct thread_pool *);
+static void csv_task (void *job_, size_t begin, size_t end, int worker);
+static bool csv_is_data (const char *p, const char *end, bool first);
+static bool csv_parse (const char *line, struct body_store *b, size_t i);
+static bool csv_color (const char *p, Color *color);
+
+/* Initializes STORE with the bodies in the file at PATH, using the
+   threads of POOL.  Returns false, after printing why, if PATH
+   cannot be read. */
+bool load_bodies (struct body_store *store, const char *path,
+                  struct thread_pool *pool)
+{
+  int fd = open (path, O_RDONLY);
+  if (fd < 0)
+    {
+      fprintf (stderr, "load: cannot open %s\n", path);
+      return false;
+    }
+  struct stat st;
+  void *map = MAP_FAILED;
+  if (fstat (fd, &st) == 0 && st.st_size > 0)
+    map = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);
+  if (map == MAP_FAILED)
+    {
+      fprintf (stderr, "load: %s is empty or cannot be mapped\n", path);
+      return false;
+    }
+  size_t size = st.st_size;
+
+  /* The whole file is read once, front to back. */
+  madvise (map, size, MADV_SEQUENTIAL);
+  bool ok = (size >= sizeof LOAD_MAGIC - 1
+             && memcmp (map, LOAD_MAGIC, sizeof LOAD_MAGIC - 1) == 0)
+            ? load_columns (store, path, map, size, pool)
+            : load_csv (store, path, map, size, pool);
+  munmap (map, size);
+  return ok;
+}
+
+/* Loads the column file of SIZE bytes mapped at MAP into STORE. */
+static bool load_columns (struct body_store *store, const char *path,
+                          const unsigned char *map, size_t size,
+                          struct thread_pool *pool)
+{
+  struct load_columns_header hdr;
+  if (size < sizeof hdr)
+    {
+      fprintf (stderr, "load: %s: truncated\n", path);
+      return false;
+    }
+  memcpy (&hdr, map, sizeof hdr);
+
+  bool swapped = hdr.endian != LOAD_ENDIAN;
+  if (swapped)
+    {
+      if (__builtin_bswap32 (hdr.endian) != LOAD_ENDIAN)
+        {
+          fprintf (stderr, "load: %s: unknown byte order\n", path);
+          return false;
+        }
+      hdr.version = __builtin_bswap32 (hdr.version);
+      hdr.cnt = __builtin_bswap64 (hdr.cnt);
+      hdr.flags = __builtin_bswap32 (hdr.flags);
+    }
+  if (hdr.version != LOAD_VERSION)
+    {
+      fprintf (stderr, "load: %s: unsupported version %u\n",
+               path, (unsigned) hdr.version);
+      return false;
+    }
+
+  bool color = (hdr.flags & LOAD_COLOR) != 0;
+  size_t per_body = COLUMN_CNT * sizeof (double) + (color ? sizeof (Color) : 0);
+  if (hdr.cnt > (size - sizeof hdr) / per_body)
+    {
+      fprintf (stderr, "load: %s: truncated\n", path);
+      return false;
+    }
+
+  body_store_init (store, hdr.cnt);
+  struct columns_job job = {store, map + sizeof hdr, hdr.cnt, swapped, color};
+  thread_pool_run (pool, hdr.cnt, columns_task, &job);
+  return true;
+}
+
+/* Copies bodies BEGIN..END of the column file of JOB_ into its body
+   store. */
+static void columns_task (void *job_, size_t begin, size_t end, int worker)
+{
+  struct columns_job *job = job_;
+  struct body_store *b = job->bodies;
+  double *dst[COLUMN_CNT] = {b->pos_x, b->pos_y, b->vel_x, b->vel_y,
+                             b->mass, b->radius};
+  size_t n = end - begin;
+
+  for (int c = 0; c < COLUMN_CNT; c++)
+    {
+      const unsigned char *src = job->base
+                                 + (c * job->cnt + begin) * sizeof (double);
+      if (!job->swapped)
+        memcpy (dst[c] + begin, src, n * sizeof (double));
+      else
+        for (size_t i = 0; i < n; i++)
+          {
+            uint64_t v;
+            memcpy (&v, src + i * sizeof v, sizeof v);
+            v = __builtin_bswap64 (v);
+            memcpy (dst[c] + begin + i, &v, sizeof v);
+          }
+    }
+
+  if (job->color)
+    memcpy (b->color + begin,
+            job->base + (COLUMN_CNT * job->cnt + begin) * sizeof (double),
+            n * sizeof (Color));
+  else
+    for (size_t i = begin; i < end; i++)
+      b->color[i] = RAYWHITE;
+}
+
+/* Loads the SIZE bytes of CSV TEXT into STORE. */
+static bool load_csv (struct body_store *store, const char *path,
+                      const char *text, size_t size, struct thread_pool *pool)
+{
+  /* Find the data lines.  This pass only looks for newlines; the
+     parsing is done in parallel below. */
+  size_t cnt = 0, cap = 1024;
+  size_t *lines = malloc (cap * sizeof *lines);
+  if (lines == NULL)
+    {
+      fprintf (stderr, "load: out of memory\n");
+      exit (1);
+    }
+  const char *end = text + size;
+  bool first = true;
+  for (const char *p = text; p < end; )
+    {
+      const char *nl = memchr (p, '\n', end - p);
+      const char *eol = nl ? nl : end;
+      if (csv_is_data (p, eol, first))
+        {
+          if (cnt == cap)
+            {
+              cap *= 2;
+              size_t *grown = realloc (lines, cap * sizeof *lines);
+              if (grown == NULL)
+                free (lines);
+              lines = grown;
+            }
+          if (lines == NULL)
+            {
+              fprintf (stderr, "load: out of memory\n");
+              exit (1);
+            }
+          lines[cnt++] = p - text;
+        }
+      if (p != eol && *p != '#')
+        first = false;
+      p = eol + 1;
+    }
+
+  if (cnt == 0)
+    {
+      fprintf (stderr, "load: %s: no bodies\n", path);
+      free (lines);
+      return false;
+    }
+
+  int threads = pool->thread_cnt;
+  size_t bad[THREAD_POOL_MAX];
+  for (int w = 0; w < threads; w++)
+    bad[w] = cnt;
+
+  body_store_init (store, cnt);
+  struct csv_job job = {store, text, size, lines, bad};
+  thread_pool_run (pool, cnt, csv_task, &job);
+
+  size_t first_bad = cnt;
+  for (int w = 0; w < threads; w++)
+    if (bad[w] < first_bad)
+      first_bad = bad[w];
+  if (first_bad < cnt)
+    {
+      size_t line_no = 1;
+      for (size_t i = 0; i < lines[first_bad]; i++)
+        line_no += text[i] == '\n';
+      fprintf (stderr, "load: %s:%zu: expected x, y, vx, vy, mass, radius "
+               "[, color]\n", path, line_no);
+      body_store_destroy (store);
+    }
+  free (lines);
+  return first_bad == cnt;
+}
+
+/* Parses the lines of bodies BEGIN..END of the CSV file of JOB_
+   into its body store. */
+static void csv_task (void *job_, size_t begin, size_t end, int worker)
+{
+  struct csv_job *job = job_;
+  const char *text_end = job->text + job->size;
+
+  for (size_t i = begin; i < end; i++)
+    {
+      /* Copy the line out: the mapping is not NUL-terminated. */
+      char line[CSV_LINE_MAX + 1];
+      const char *p = job->text + job->lines[i];
+      size_t len = 0;
+      while (p + len < text_end && p[len] != '\n' && len < CSV_LINE_MAX)
+        len++;
+      bool too_long = p + len < text_end && p[len] != '\n';
+      memcpy (line, p, len);
+      line[len] = '\0';
+
+      if (too_long || !csv_parse (line, job->bodies, i))
+        {
+          job->bad[worker] = i;
+          return;
+        }
+    }
+}
+
+/* Returns true if the line from P to END holds a body: it is not
+   blank, not a '#' comment and, if FIRST, not a column header. */
+static bool csv_is_data (const char *p, const char *end, bool first)
+{
+  while (p < end && isspace ((unsigned char) *p))
+    p++;
+  if (p == end || *p == '#')
+    return false;
+  return !first || isdigit ((unsigned char) *p) || *p == '-' || *p == '+'
+         || *p == '.';
+}
+
+/* Parses LINE into body I of B.  Returns false on a malformed
+   line. */
+static bool csv_parse (const char *line, struct body_store *b, size_t i)
+{
+  double *dst[COLUMN_CNT] = {&b->pos_x[i], &b->pos_y[i], &b->vel_x[i],
+                             &b->vel_y[i], &b->mass[i], &b->radius[i]};
+  const char *p = line;
+  for (int c = 0; c < COLUMN_CNT; c++)
+    {
+      char *end;
+      *dst[c] = strtod (p, &end);
+      if (end == p)
+        return false;
+      p = end;
+      while (isspace ((unsigned char) *p))
+        p++;
+      if (c < COLUMN_CNT - 1)
+        {
+          if (*p != ',')
+            return false;
+          p++;
+        }
+    }
+
+  b->color[i] = RAYWHITE;
+  if (*p == ',')
+    {
+      if (!csv_color (p + 1, &b->color[i]))
+        return false;
+    }
+  else if (*p != '\0')
+    return false;
+  return b->mass[i] > 0 && b->radius[i] >= 0;
+}
+
+/* Parses the hex color at P into *COLOR.  Returns false unless P
+   holds RRGGBB or RRGGBBAA, with an optional leading '#', and
+   nothing else but spaces. */
+static bool csv_color (const char *p, Color *color)
+{
+  while (isspace ((unsigned char) *p))
+    p++;
+  if (*p == '#')
+    p++;
+  int digits = 0;
+  unsigned long v = 0;
+  for (; isxdigit ((unsigned char) *p) && digits < 9; p++, digits++)
+    v = v * 16 + (isdigit ((unsigned char) *p) ? *p - '0'
+                  : tolower ((unsigned char) *p) - 'a' + 10);
+  while (isspace ((unsigned char) *p))
+    p++;
+  if (*p != '\0' || (digits != 6 && digits != 8))
+    return false;
+  if (digits == 6)
+    v = v << 8 | 0xff;
+  *color = (Color) {v >> 24 & 0xff, v >> 16 & 0xff, v >> 8 & 0xff, v & 0xff};
+  return true;
+}
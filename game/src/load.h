@@ -0,0 +1,51 @@
+#ifndef LOAD_H
+#define LOAD_H
+#include <stdbool.h>
+#include <stdint.h>
+#include "body.h"
+#include "thread_pool.h"
+
+/* Body files.
+
+   load_bodies() reads the initial bodies from a file in either of
+   two formats, told apart by their first bytes.
+
+   Column files are binary: a load_columns_header, then the arrays
+   x, y, vx, vy, mass and radius of CNT doubles each, back to back,
+   and with LOAD_COLOR set, CNT colors of 4 bytes (r, g, b, a).
+   Numbers are in the writer's byte order, given by ENDIAN.  The
+   file is mapped and the arrays are copied, or swapped, straight
+   into the body store by the threads of the pool, so loading runs
+   at memory speed.
+
+   Any other file is read as CSV: one body per line with the fields
+   x, y, vx, vy, mass, radius and an optional color, written as hex
+   RRGGBB or RRGGBBAA with or without a leading '#'.  Fields are
+   separated by commas, blank lines and lines starting with '#' are
+   skipped, and so is a first line that does not start with a
+   number, so files may carry a column header.  Masses must be
+   positive and radii not negative.  Lines are parsed in
+   parallel. */
+
+#define LOAD_MAGIC "NBODYCOL"
+#define LOAD_VERSION 1
+#define LOAD_ENDIAN 0x01020304u
+
+/* Column file flags. */
+#define LOAD_COLOR 1            /* Colors follow the radii. */
+
+/* Column file header. */
+struct load_columns_header
+{
+  char magic[8];              /* LOAD_MAGIC, not terminated. */
+  uint32_t version;
+  uint32_t endian;            /* LOAD_ENDIAN as written. */
+  uint64_t cnt;               /* Bodies. */
+  uint32_t flags;
+  uint32_t reserved;
+};
+
+bool load_bodies (struct body_store *, const char *path,
+                  struct thread_pool *);
+
+#endif /* load.h */
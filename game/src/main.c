@@ -1,318 +1,762 @@
+#include <pthread.h>
 #include <stdio.h>
 #include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include "raylib.h"
 #include "body.h"
-#include "list.h"
+#include "sim.h"
+#include "snapshot.h"
+#include "render.h"
+#include "checkpoint.h"
+#include "trajectory.h"
+#include "load.h"
+#include "profile.h"
 #include <math.h>
 
+/* Command Line Options */
+struct options
+{
+  bool headless;        /* Run without a window */
+  size_t bodies;        /* Number of bodies */
+  enum ic_model ic;     /* Initial conditions */
+  const char *load;     /* Body file to start from, or NULL */
+  uint64_t steps;       /* Steps to run headless */
+  double dt;            /* Time step */
+  uint64_t seed;        /* Random seed */
+  int threads;          /* Worker threads, 0 for one per CPU */
+  enum force_solver solver;
+  enum integrator integrator;
+  enum collision_mode collisions;
+  int contact_iterations;     /* Most contact solver sweeps */
+  double restitution;         /* Share of the approach speed bounced */
+  double theta;         /* Barnes-Hut opening angle */
+  int block_levels;     /* Finest block time step level */
+  enum gravity_softening softening;
+  double eps;           /* Softening length */
+  double rate;          /* Steps per wall clock second in a window */
+  int max_catchup;      /* Most steps run between two snapshots */
+  const char *checkpoint;     /* Checkpoint file, or NULL */
+  uint64_t checkpoint_every;  /* Steps between checkpoints, 0 for
+                                 only at the end */
+  const char *restore;        /* Checkpoint to start from, or NULL */
+  const char *trajectory;     /* Trajectory file, or NULL */
+  uint64_t trajectory_every;  /* Steps between trajectory frames */
+  int trajectory_chunk;       /* Frames per trajectory chunk */
+  int trajectory_encoding;    /* TRAJ_DELTA | TRAJ_DEFLATE */
+  uint64_t stats_every;       /* Steps between counter logs, 0 for none */
+  const char *profile;        /* Chrome trace file, or NULL */
+  uint64_t profile_from;      /* First frame traced */
+  uint64_t profile_frames;    /* Frames traced */
+};
+
+/* Fixed-Timestep Scheduler
+
+   Wall clock time since the last frame is added to an accumulator
+   and paid out in whole steps of 1 / RATE seconds, so the
+   simulation advances at the same speed however fast frames are
+   drawn.  At most MAX_CATCHUP steps run between two snapshots;
+   when the simulation cannot keep up the surplus is dropped, so it
+   slows down instead of falling ever further behind. */
+struct scheduler
+{
+  double rate;          /* Target steps per wall second */
+  int max_catchup;      /* Step cap per frame */
+  double accumulator;   /* Wall time owed to the simulation */
+  double last;          /* Wall clock at the previous frame */
+
+  /* Sim time to wall time ratio, measured over about a second */
+  double window_start;  /* Wall clock at the start of the window */
+  double window_sim;    /* Sim time advanced in the window */
+  double ratio;         /* Ratio of the last complete window */
+  int steps;            /* Steps run by the last advance */
+};
+
+/* Physics Thread
+
+   In a window the simulation runs on its own thread, paced by the
+   scheduler, and publishes a snapshot after every batch of steps.
+   The render thread only ever draws the latest snapshot, so drawing
+   overlaps the next steps and a slow step never stalls the window.
+   Key presses are forwarded as counters that the physics thread
+   applies between steps; the sim itself is never shared. */
+struct physics
+{
+  struct sim *sim;
+  const struct options *opts;
+  struct scheduler sched;
+  struct checkpoint_writer *ckp;  /* NULL without --checkpoint */
+  uint64_t ckp_step;    /* Step of the last checkpoint */
+  struct trajectory_writer *traj; /* NULL without --trajectory */
+  uint64_t traj_step;   /* Step of the last trajectory frame */
+  uint64_t stats_step;  /* Step of the last counter log */
+  struct sim_stats stats_total;   /* Sim totals at that step */
+  struct snapshot_buffer snaps;
+  pthread_t thread;
+
+  /* Set by the render thread, accessed atomically */
+  int quit;
+  int solver_toggles;
+  int integrator_cycles;
+  int isa_cycles;
+  int precision_toggles;
+  int theta_steps;      /* Opening angle change in tenths */
+  int collision_toggles;
+
+  /* Bodies to spawn, in world coordinates, protected by SPAWN_LOCK */
+  pthread_mutex_t spawn_lock;
+  Vector2 spawns[16];
+  int spawn_cnt;
+};
+
 /* Static Functions */
-static void init_bodies (struct body *bodies, size_t cnt, float pct_heavy);
-static void draw_bodies (struct body *bodies, size_t cnt);
-static void update_bodies (struct body *bodies, size_t cnt);
-static void handle_collision (struct body *bodies, size_t cnt, size_t steps);
-static double get_distance (struct body *bdyA, struct body *bdyB);
-static void resolve_collision(struct body *bdyA, struct body *bdyB, double distance);
+static bool parse_options (int argc, char **argv, struct options *opts);
+static void usage (const char *prog);
+static int run_headless (struct sim *sim, const struct options *opts);
+static int run_window (struct sim *sim, const struct options *opts);
+static void scheduler_init (struct scheduler *sched, const struct options *opts);
+static void scheduler_advance (struct scheduler *sched, struct sim *sim);
+static double scheduler_wait (const struct scheduler *sched);
+static void *physics_main (void *phys_);
+static bool physics_apply_input (struct physics *phys);
+static void physics_publish (struct physics *phys);
+static void checkpoint_due (struct checkpoint_writer *ckp,
+                            const struct sim *sim,
+                            const struct options *opts, uint64_t *last);
+static void trajectory_due (struct trajectory_writer *traj,
+                            const struct sim *sim,
+                            const struct options *opts, uint64_t *last);
+static bool trajectory_finish (struct trajectory_writer *traj);
+static void stats_due (const struct sim *sim, const struct options *opts,
+                       uint64_t *last_step, struct sim_stats *last_total);
 static void handle_camera_pos (Camera2D *_camera);
+static void handle_solver_keys (struct physics *phys);
+static void handle_render_keys (struct circle_renderer *renderer);
+static void handle_spawn_clicks (struct physics *phys, Camera2D camera);
+static void draw_solver_info (const struct snapshot *snap,
+                              const struct circle_renderer *renderer);
+static void draw_profile (void);
+
+int main(int argc, char **argv)
+{
+    struct options opts;
+    if (!parse_options (argc, argv, &opts))
+    {
+      usage (argv[0]);
+      return 1;
+    }
+
+    if (!opts.headless)
+    {
+      InitWindow(SCRNW, SRCHT, "n-body");
+      SetTargetFPS(60);
+    }
+    else
+      SetTraceLogLevel (LOG_WARNING);   /* Keep the report readable */
+
+    /* A checkpoint replaces the bodies, so none are made for it */
+    struct sim sim;
+    double setup = sim_clock ();
+    bool fresh = opts.load == NULL && opts.restore == NULL;
+    sim_init (&sim, fresh ? opts.bodies : 0, opts.ic, opts.dt, opts.seed,
+              opts.threads);
+    if (opts.load != NULL && opts.restore == NULL)
+    {
+      struct body_store store;
+      if (!load_bodies (&store, opts.load, &sim.pool))
+      {
+        sim_destroy (&sim);
+        if (!opts.headless)
+          CloseWindow();
+        return 1;
+      }
+      sim_set_bodies (&sim, &store);
+    }
+    sim.solver = opts.solver;
+    sim.integrator = opts.integrator;
+    sim.collisions = opts.collisions;
+    sim.contacts.iterations = opts.contact_iterations;
+    sim.contacts.restitution = opts.restitution;
+    sim.tree.theta = opts.theta;
+    sim.block.max_level = opts.block_levels;
+    sim_set_softening (&sim, opts.softening, opts.eps);
+
+    /* A checkpoint's own settings win over the command line */
+    bool ready = opts.restore == NULL || checkpoint_load (&sim, opts.restore);
+    setup = sim_clock () - setup;
+    if (ready && opts.headless)
+      printf ("n-body setup: %zu bodies from %s in %.3f s\n",
+              sim.bodies.cnt,
+              opts.restore ? opts.restore
+              : opts.load ? opts.load : ic_model_name (opts.ic),
+              setup);
+
+    int status = 1;
+    profile_thread_name (opts.headless ? "main" : "render");
+    if (opts.profile != NULL)
+      profile_capture (opts.profile_from, opts.profile_frames);
+    if (ready)
+      status = opts.headless ? run_headless (&sim, &opts)
+                             : run_window (&sim, &opts);
+
+    sim_destroy (&sim);
+    if (opts.profile != NULL && !profile_write_trace (opts.profile))
+      status = 1;
+    profile_shutdown ();
+    if (!opts.headless)
+      CloseWindow();
+    return status;
+}
+
+/* Parses the command line ARGV into OPTS.  Returns false on a bad
+   option. */
+static bool parse_options (int argc, char **argv, struct options *opts)
+{
+  opts->headless = false;
+  opts->bodies = 800;
+  opts->ic = IC_UNIFORM;
+  opts->load = NULL;
+  opts->steps = 1000;
+  opts->dt = .10;
+  opts->seed = (uint64_t) time (NULL);
+  opts->threads = 0;
+  opts->solver = SOLVER_BARNES_HUT;
+  opts->integrator = INTEGRATOR_EULER;
+  opts->collisions = COLLISION_BOUNCE;
+  opts->contact_iterations = 8;
+  opts->restitution = .8;
+  opts->theta = QT_DEFAULT_THETA;
+  opts->block_levels = 6;
+  opts->softening = GRAVITY_SOFT_SPLINE;
+  opts->eps = SIM_DEFAULT_EPS;
+  opts->rate = 60;
+  opts->max_catchup = 8;
+  opts->checkpoint = NULL;
+  opts->checkpoint_every = 0;
+  opts->restore = NULL;
+  opts->trajectory = NULL;
+  opts->trajectory_every = 1;
+  opts->trajectory_chunk = 16;
+  opts->trajectory_encoding = TRAJ_DELTA | TRAJ_DEFLATE;
+  opts->stats_every = 0;
+  opts->profile = NULL;
+  opts->profile_from = 0;
+  opts->profile_frames = 300;
+
+  for (int i = 1; i < argc; i++)
+  {
+    const char *arg = argv[i];
+    const char *val = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+    if (strcmp (arg, "--headless") == 0)
+    {
+      opts->headless = true;
+      continue;
+    }
+    if (val == NULL)
+      return false;
+    i++;
+
+    if (strcmp (arg, "--bodies") == 0) opts->bodies = strtoull (val, NULL, 10);
+    else if (strcmp (arg, "--steps") == 0) opts->steps = strtoull (val, NULL, 10);
+    else if (strcmp (arg, "--dt") == 0) opts->dt = strtod (val, NULL);
+    else if (strcmp (arg, "--seed") == 0) opts->seed = strtoull (val, NULL, 10);
+    else if (strcmp (arg, "--threads") == 0) opts->threads = atoi (val);
+    else if (strcmp (arg, "--theta") == 0) opts->theta = strtod (val, NULL);
+    else if (strcmp (arg, "--contact-iterations") == 0) opts->contact_iterations = atoi (val);
+    else if (strcmp (arg, "--restitution") == 0) opts->restitution = strtod (val, NULL);
+    else if (strcmp (arg, "--block-levels") == 0) opts->block_levels = atoi (val);
+    else if (strcmp (arg, "--eps") == 0) opts->eps = strtod (val, NULL);
+    else if (strcmp (arg, "--softening") == 0)
+    {
+      opts->softening = sim_softening_by_name (val);
+      if (opts->softening == GRAVITY_SOFT_CNT)
+        return false;
+    }
+    else if (strcmp (arg, "--rate") == 0) opts->rate = strtod (val, NULL);
+    else if (strcmp (arg, "--max-catchup") == 0) opts->max_catchup = atoi (val);
+    else if (strcmp (arg, "--checkpoint") == 0) opts->checkpoint = val;
+    else if (strcmp (arg, "--checkpoint-every") == 0) opts->checkpoint_every = strtoull (val, NULL, 10);
+    else if (strcmp (arg, "--restore") == 0) opts->restore = val;
+    else if (strcmp (arg, "--trajectory") == 0) opts->trajectory = val;
+    else if (strcmp (arg, "--trajectory-every") == 0) opts->trajectory_every = strtoull (val, NULL, 10);
+    else if (strcmp (arg, "--trajectory-chunk") == 0) opts->trajectory_chunk = atoi (val);
+    else if (strcmp (arg, "--trajectory-encoding") == 0)
+    {
+      opts->trajectory_encoding = trajectory_encoding_by_name (val);
+      if (opts->trajectory_encoding < 0)
+        return false;
+    }
+    else if (strcmp (arg, "--load") == 0) opts->load = val;
+    else if (strcmp (arg, "--stats-every") == 0) opts->stats_every = strtoull (val, NULL, 10);
+    else if (strcmp (arg, "--profile") == 0) opts->profile = val;
+    else if (strcmp (arg, "--profile-from") == 0) opts->profile_from = strtoull (val, NULL, 10);
+    else if (strcmp (arg, "--profile-frames") == 0) opts->profile_frames = strtoull (val, NULL, 10);
+    else if (strcmp (arg, "--ic") == 0)
+    {
+      opts->ic = ic_model_by_name (val);
+      if (opts->ic == IC_CNT)
+        return false;
+    }
+    else if (strcmp (arg, "--solver") == 0)
+    {
+      opts->solver = sim_solver_by_name (val);
+      if (opts->solver == SOLVER_CNT)
+        return false;
+    }
+    else if (strcmp (arg, "--integrator") == 0)
+    {
+      opts->integrator = sim_integrator_by_name (val);
+      if (opts->integrator == INTEGRATOR_CNT)
+        return false;
+    }
+    else if (strcmp (arg, "--collisions") == 0)
+    {
+      opts->collisions = sim_collision_by_name (val);
+      if (opts->collisions == COLLISION_CNT)
+        return false;
+    }
+    else
+      return false;
+  }
+  return opts->bodies > 0 && opts->dt > 0 && opts->theta >= 0
+         && opts->block_levels >= 0 && opts->block_levels <= BLOCK_MAX_LEVEL
+         && opts->contact_iterations > 0
+         && opts->restitution >= 0 && opts->restitution <= 1
+         && opts->rate > 0 && opts->max_catchup > 0
+         && opts->trajectory_every > 0 && opts->trajectory_chunk > 0;
+}
 
+/* Prints the command line help */
+static void usage (const char *prog)
+{
+  fprintf (stderr,
+           "usage: %s [options]\n"
+           "  --headless              run without a window and report throughput\n"
+           "  --bodies N              number of bodies (800)\n"
+           "  --ic uniform|plummer|disk|collapse|lattice|galaxies\n"
+           "                          initial conditions (uniform)\n"
+           "  --load PATH             read the bodies from a CSV or column file\n"
+           "  --steps N               steps to run headless (1000)\n"
+           "  --dt X                  time step (0.1)\n"
+           "  --seed N                random seed (current time)\n"
+           "  --threads N             worker threads (one per CPU)\n"
+           "  --solver direct|barnes-hut|symmetric\n"
+           "                          force solver (barnes-hut)\n"
+           "  --integrator euler|leapfrog|verlet|yoshida|block\n"
+           "                          time integrator (euler)\n"
+           "  --collisions bounce|merge|none\n"
+           "                          collision response (bounce)\n"
+           "  --contact-iterations N  most contact solver sweeps per step (8)\n"
+           "  --restitution X         share of the approach speed bounced (0.8)\n"
+           "  --theta X               Barnes-Hut opening angle (0.5)\n"
+           "  --block-levels N        finest block step is dt / 2^N (6)\n"
+           "  --softening none|plummer|spline\n"
+           "                          softening law (spline)\n"
+           "  --eps X                 softening length (10)\n"
+           "  --rate X                steps per second in a window (60)\n"
+           "  --max-catchup N         most steps between two snapshots (8)\n"
+           "  --checkpoint PATH       write a checkpoint to PATH on exit\n"
+           "  --checkpoint-every N    and every N steps (0: only on exit)\n"
+           "  --restore PATH          continue from the checkpoint at PATH\n"
+           "  --trajectory PATH       record positions and velocities to PATH\n"
+           "  --trajectory-every N    steps between frames (1)\n"
+           "  --trajectory-chunk N    frames per chunk (16)\n"
+           "  --trajectory-encoding raw|delta|deflate|delta-deflate\n"
+           "                          frame encoding (delta-deflate)\n"
+           "  --stats-every N         log the event counters every N steps\n"
+           "  --profile PATH          write a Chrome trace of some frames to PATH\n"
+           "  --profile-from N        first traced frame, a step headless (0)\n"
+           "  --profile-frames N      frames traced (300)\n",
+           prog);
+}
 
-/* Global Constants */
-const double dt = .10;
-struct list collided_bodies;
+/* Runs SIM for the requested number of steps as fast as possible
+   and prints the throughput */
+static int run_headless (struct sim *sim, const struct options *opts)
+{
+  uint64_t body_evals = 0;
+
+  printf ("n-body headless: %zu bodies, %llu steps, dt=%g, seed=%llu, "
+          "solver=%s, integrator=%s, collisions=%s, softening=%s/%g, "
+          "threads=%d\n",
+          sim->bodies.cnt, (unsigned long long) opts->steps, sim->dt,
+          (unsigned long long) sim->seed,
+          sim_solver_name (sim->solver),
+          sim_integrator_name (sim->integrator),
+          sim_collision_name (sim->collisions),
+          gravity_softening_name (sim->direct.softening), sim->direct.eps,
+          sim->pool.thread_cnt);
+
+  struct checkpoint_writer ckp;
+  uint64_t ckp_step = sim->step_cnt;
+  if (opts->checkpoint != NULL)
+    checkpoint_writer_init (&ckp);
+
+  /* The initial state is the first frame */
+  struct trajectory_writer traj;
+  uint64_t traj_step = sim->step_cnt;
+  bool traj_open = opts->trajectory != NULL
+                   && trajectory_writer_open (&traj, opts->trajectory, sim,
+                                              opts->trajectory_encoding,
+                                              opts->trajectory_chunk);
+  if (traj_open)
+    trajectory_writer_push (&traj, sim, true);
+
+  uint64_t stats_step = sim->step_cnt;
+  struct sim_stats stats_total = sim->total;
+  struct sim_stats run_start = sim->total;
+  double start = sim_clock ();
+  for (uint64_t s = 0; s < opts->steps; s++)
+  {
+    sim_step (sim);
+    body_evals += sim->block.active_sum;
+    if (opts->checkpoint != NULL)
+      checkpoint_due (&ckp, sim, opts, &ckp_step);
+    if (traj_open)
+      trajectory_due (&traj, sim, opts, &traj_step);
+    stats_due (sim, opts, &stats_step, &stats_total);
+    profile_frame ();
+  }
+  double elapsed = sim_clock () - start;
+  struct sim_stats run = sim->total;
+  sim_stats_sub (&run, &run_start);
 
-int main(void)
+  if (opts->checkpoint != NULL)
+  {
+    if (ckp_step != sim->step_cnt)
+      checkpoint_writer_submit (&ckp, sim, opts->checkpoint);
+    checkpoint_writer_destroy (&ckp);
+  }
+  bool traj_ok = !traj_open || trajectory_finish (&traj);
+  if (elapsed <= 0)
+    elapsed = 1e-9;
+
+  printf ("%llu steps in %.3f s: %.1f steps/s, %.3e pair interactions/s\n",
+          (unsigned long long) opts->steps, elapsed, opts->steps / elapsed,
+          run.interactions / elapsed);
+  printf ("%llu force evaluations, %.3g sim time per wall second\n",
+          (unsigned long long) run.force_evals, opts->steps * sim->dt / elapsed);
+  if (sim->integrator == INTEGRATOR_BLOCK)
+  {
+    printf ("%.1f body force evaluations per step, bodies per level:",
+            (double) body_evals / opts->steps);
+    for (int l = 0; l <= sim->block.max_level; l++)
+      printf (" %zu", sim->block.level_cnt[l]);
+    printf ("\n");
+  }
+  if (sim->collisions == COLLISION_BOUNCE)
+  {
+    printf ("%llu candidate pairs, %llu contacts: %llu resolved, "
+            "%llu separating, %llu corrections\n",
+            (unsigned long long) run.candidates,
+            (unsigned long long) run.contacts,
+            (unsigned long long) run.resolved,
+            (unsigned long long) run.separating,
+            (unsigned long long) run.corrections);
+    printf ("%llu contacts warm started, %llu solver sweeps, "
+            "%llu contact visits\n",
+            (unsigned long long) run.warm_started,
+            (unsigned long long) run.sweeps,
+            (unsigned long long) run.visits);
+  }
+  if (sim->collisions == COLLISION_MERGE)
+    printf ("%llu mergers, %zu bodies left\n",
+            (unsigned long long) run.merged, sim->bodies.cnt);
+  return (opts->trajectory == NULL || (traj_open && traj_ok)) ? 0 : 1;
+}
+
+/* Runs SIM interactively until the window is closed.  SIM is
+   stepped on a physics thread while this thread draws. */
+static int run_window (struct sim *sim, const struct options *opts)
 {
-    const int screenWidth = SCRNW;
-    const int screenHeight = SRCHT;
-    const int bdy_cnt = 800;
-    
-    InitWindow(screenWidth, screenHeight, "n-body");
-    SetTargetFPS(60);
-    
     Camera2D camera = {0};
     camera.target =  (Vector2) {0,0};
     camera.zoom = 1;
 
-    struct body bodies[bdy_cnt];
-    init_bodies (bodies, bdy_cnt, .01);
-    list_init (&collided_bodies);
-    
+    struct circle_renderer renderer;
+    circle_renderer_init (&renderer);
+    bool show_profile = false;
+
+    struct checkpoint_writer ckp;
+    struct physics phys = {0};
+    phys.sim = sim;
+    pthread_mutex_init (&phys.spawn_lock, NULL);
+    phys.opts = opts;
+    phys.ckp_step = sim->step_cnt;
+    phys.stats_step = sim->step_cnt;
+    phys.stats_total = sim->total;
+    if (opts->checkpoint != NULL)
+    {
+      checkpoint_writer_init (&ckp);
+      phys.ckp = &ckp;
+    }
+    struct trajectory_writer traj;
+    phys.traj_step = sim->step_cnt;
+    if (opts->trajectory != NULL
+        && trajectory_writer_open (&traj, opts->trajectory, sim,
+                                   opts->trajectory_encoding,
+                                   opts->trajectory_chunk))
+    {
+      phys.traj = &traj;
+      trajectory_writer_push (phys.traj, sim, false);
+    }
+    scheduler_init (&phys.sched, opts);
+    snapshot_buffer_init (&phys.snaps);
+    physics_publish (&phys);
+    if (pthread_create (&phys.thread, NULL, physics_main, &phys) != 0)
+    {
+      fprintf (stderr, "n-body: cannot create physics thread\n");
+      if (phys.ckp != NULL)
+        checkpoint_writer_destroy (phys.ckp);
+      if (phys.traj != NULL)
+        trajectory_finish (phys.traj);
+      snapshot_buffer_destroy (&phys.snaps);
+      pthread_mutex_destroy (&phys.spawn_lock);
+      circle_renderer_destroy (&renderer);
+      return 1;
+    }
+
     while (!WindowShouldClose())    // Detect window close button or ESC key
     {
       // Update
-      update_bodies (bodies, bdy_cnt); 
+      const struct snapshot *snap = snapshot_buffer_latest (&phys.snaps);
       handle_camera_pos (&camera);
+      handle_solver_keys (&phys);
+      handle_render_keys (&renderer);
+      handle_spawn_clicks (&phys, camera);
+      if (IsKeyPressed (KEY_F)) show_profile = !show_profile;
       
       /* Draw Bodies */
+      PROFILE_BEGIN (PROFILE_DRAW);
       BeginDrawing();
         BeginMode2D (camera);
           ClearBackground(BLACK);
           
-          draw_bodies (bodies, bdy_cnt);
+          circle_renderer_draw (&renderer, snap);
         EndMode2D();
+        draw_solver_info (snap, &renderer);
+        if (show_profile)
+          draw_profile ();
+      PROFILE_END (PROFILE_DRAW);
+      PROFILE_BEGIN (PROFILE_PRESENT);
       EndDrawing();
+      PROFILE_END (PROFILE_PRESENT);
+      profile_frame ();
     }
 
-    CloseWindow();
+    __atomic_store_n (&phys.quit, 1, __ATOMIC_RELEASE);
+    pthread_join (phys.thread, NULL);
+    if (phys.ckp != NULL)
+    {
+      if (phys.ckp_step != sim->step_cnt)
+        checkpoint_writer_submit (phys.ckp, sim, opts->checkpoint);
+      checkpoint_writer_destroy (phys.ckp);
+    }
+    if (phys.traj != NULL)
+      trajectory_finish (phys.traj);
+    snapshot_buffer_destroy (&phys.snaps);
+    pthread_mutex_destroy (&phys.spawn_lock);
+    circle_renderer_destroy (&renderer);
     return 0;
 }
 
-/* Initializes Bodies Array 'BODIES' of count 'CNT' */
-static void init_bodies (struct body *bodies, size_t cnt, float pct_heavy)
+/* Steps the sim of PHYS_ on schedule and publishes a snapshot after
+   every batch of steps, until asked to quit */
+static void *physics_main (void *phys_)
 {
-  /* Number of heavy bodies and light bodies */
-  int heavy_cnt = cnt * pct_heavy;
-  int light_cnt = cnt - heavy_cnt;
-  int random_spawn_range = 5 * cnt;
-  
-  printf ("cnt=%ld\n", cnt);
-  printf ("heavy_cnt=%d\n", heavy_cnt);
-  printf ("Light_cnt=%d\n", light_cnt);
+  struct physics *phys = phys_;
 
-  while (heavy_cnt--)
+  profile_thread_name ("physics");
+  while (!__atomic_load_n (&phys->quit, __ATOMIC_ACQUIRE))
   {
-    cnt--;
-    printf("Spawning heavy !\n");
-    printf ("cnt=%ld\n", cnt);
-    struct body *bdy = &bodies[cnt];
-    bdy->color = RAYWHITE;
-    bdy->radius = 10;
-    bdy->mass = 50;//GetRandomValue (20, 9999);
-    bdy->posX = CENTER_X + GetRandomValue(-1 * random_spawn_range, random_spawn_range);
-    bdy->posY = CENTER_Y + GetRandomValue(-1 * random_spawn_range, random_spawn_range); 
-    bdy->vel_x = 0;
-    bdy->vel_y = 0;
-    
+    bool changed = physics_apply_input (phys);
+    scheduler_advance (&phys->sched, phys->sim);
+    if (phys->sched.steps > 0 || changed)
+      physics_publish (phys);
+    if (phys->ckp != NULL)
+      checkpoint_due (phys->ckp, phys->sim, phys->opts, &phys->ckp_step);
+    if (phys->traj != NULL)
+      trajectory_due (phys->traj, phys->sim, phys->opts, &phys->traj_step);
+    stats_due (phys->sim, phys->opts, &phys->stats_step, &phys->stats_total);
+
+    /* Sleep until the next step is due, but wake up often enough
+       to notice input and quit requests */
+    double wait = scheduler_wait (&phys->sched);
+    if (wait > .01)
+      wait = .01;
+    if (wait > 0)
+    {
+      struct timespec ts = {0, (long) (wait * 1e9)};
+      nanosleep (&ts, NULL);
+    }
   }
+  return NULL;
+}
 
-  while (light_cnt --)
+/* Applies the key presses forwarded to PHYS since the last call.
+   Returns true if any setting changed. */
+static bool physics_apply_input (struct physics *phys)
+{
+  struct sim *sim = phys->sim;
+  int solver = __atomic_exchange_n (&phys->solver_toggles, 0, __ATOMIC_RELAXED);
+  int integrator = __atomic_exchange_n (&phys->integrator_cycles, 0, __ATOMIC_RELAXED);
+  int isa = __atomic_exchange_n (&phys->isa_cycles, 0, __ATOMIC_RELAXED);
+  int precision = __atomic_exchange_n (&phys->precision_toggles, 0, __ATOMIC_RELAXED);
+  int theta = __atomic_exchange_n (&phys->theta_steps, 0, __ATOMIC_RELAXED);
+  int collisions = __atomic_exchange_n (&phys->collision_toggles, 0, __ATOMIC_RELAXED);
+
+  sim->solver = (sim->solver + solver) % SOLVER_CNT;
+  sim->integrator = (sim->integrator + integrator) % INTEGRATOR_CNT;
+  sim->collisions = (sim->collisions + collisions) % COLLISION_CNT;
+  for (int i = 0; i < isa; i++)
   {
-    cnt--;
-    printf("Spawning light !\n");
-    printf ("cnt=%ld\n", cnt);
-    
-    struct body *bdy = &bodies[cnt];
-    bdy->color = RAYWHITE;
-    bdy->radius = 10;
-    bdy->mass = 10;//GetRandomValue (1, 10);
-    bdy->posX = CENTER_X + GetRandomValue(-1 * random_spawn_range, random_spawn_range);
-    bdy->posY = CENTER_Y + GetRandomValue(-1 * random_spawn_range, random_spawn_range);
-    bdy->vel_x = 0;
-    bdy->vel_y = 0;
-    
+    enum gravity_isa cur = gravity_get_isa ();
+    gravity_set_isa (cur == gravity_max_isa () ? GRAVITY_ISA_SCALAR : cur + 1);
   }
-  
-  printf("DONEGNERATINGBODIES\n");
-
+  if (precision & 1)
+    sim->direct.precision = (sim->direct.precision == GRAVITY_DOUBLE) ? GRAVITY_FLOAT : GRAVITY_DOUBLE;
+  sim->tree.theta += theta * .1;
+  if (sim->tree.theta < 0) sim->tree.theta = 0;
+
+  pthread_mutex_lock (&phys->spawn_lock);
+  int spawned = phys->spawn_cnt;
+  Vector2 spawns[16];
+  memcpy (spawns, phys->spawns, spawned * sizeof *spawns);
+  phys->spawn_cnt = 0;
+  pthread_mutex_unlock (&phys->spawn_lock);
+  for (int i = 0; i < spawned; i++)
+    sim_add_body (sim, spawns[i].x, spawns[i].y, 0, 0, IC_MASS, IC_RADIUS,
+                  RAYWHITE);
+
+  return (solver | integrator | isa | precision | theta | collisions
+          | spawned) != 0;
 }
 
-static void draw_bodies (struct body *bodies, size_t cnt)
+/* Captures the sim of PHYS into a snapshot and hands it to the
+   render thread */
+static void physics_publish (struct physics *phys)
 {
-  while (cnt--)
-  {
-    struct body *bdy = &bodies[cnt];
-    DrawCircle (bdy->posX, bdy->posY, bdy->radius, bdy->color);            
-  }
+  PROFILE_BEGIN (PROFILE_SNAPSHOT);
+  struct snapshot *snap = snapshot_buffer_back (&phys->snaps);
+  snapshot_capture (snap, phys->sim);
+  snap->ratio = phys->sched.ratio;
+  snap->rate = phys->sched.rate;
+  snapshot_buffer_publish (&phys->snaps);
+  PROFILE_END (PROFILE_SNAPSHOT);
 }
 
-/* Updates all bodies by a time step */
-static void update_bodies (struct body *bodies, size_t cnt)
+/* Prints the event counters of SIM summed over the steps since
+   step *LAST_STEP, when OPTS asks for them every so many steps and
+   that many have passed.  *LAST_TOTAL holds SIM's totals at
+   *LAST_STEP. */
+static void stats_due (const struct sim *sim, const struct options *opts,
+                       uint64_t *last_step, struct sim_stats *last_total)
 {
-  for (int i = 0; i < cnt; i++)
-  {
-    struct body *bdy1 = &bodies[i];
-    double ax = 0;
-    double ay = 0;
-
-    for (int j = 0; j < cnt; j++)
-     {
-      if (i == j) continue;
-      struct body *bdy2 = &bodies[j];
-      
-      /* Determine Distance between bodies */
-      double radial_dist = get_distance (bdy1, bdy2);      
-      double r = pow (radial_dist, 2);
+  if (opts->stats_every == 0 || sim->step_cnt - *last_step < opts->stats_every)
+    return;
+
+  struct sim_stats d = sim->total;
+  sim_stats_sub (&d, last_total);
+  printf ("stats: steps %llu-%llu:",
+          (unsigned long long) *last_step, (unsigned long long) sim->step_cnt);
+#define PRINT(F, NAME) printf (" %llu %s,", (unsigned long long) d.F, NAME);
+  SIM_STATS (PRINT)
+#undef PRINT
+  printf (" %zu bodies\n", sim->bodies.cnt);
+  *last_step = sim->step_cnt;
+  *last_total = sim->total;
+}
 
-      /* Newton's Law of Gravity: F = mm-/r² ⟹ a = m/r² */
-      ax -= bdy2->mass * (bdy1->posX - bdy2->posX) / r; //(pow(r, bdy1->vel_x) + r);
-      ay -= bdy2->mass * (bdy1->posY - bdy2->posY) / r;//(pow(r, bdy1->vel_y) + r);
-      
-      if (radial_dist > (bdy1->radius + bdy2->radius) * .95)
-      {
-        // ax -= bdy2->mass * (bdy1->posX - bdy2->posX) / r; //(pow(r, bdy1->vel_x) + r);
-        // ay -= bdy2->mass * (bdy1->posY - bdy2->posY) / r;//(pow(r, bdy1->vel_y) + r);
-      } else {
-       
-       
-      }
-     }
-     
-     bdy1->vel_x += ax * dt;
-     bdy1->vel_y += ay * dt;
-  }
+/* Hands the state of SIM to CKP if OPTS asks for a checkpoint every
+   so many steps and that many have passed since step *LAST */
+static void checkpoint_due (struct checkpoint_writer *ckp,
+                            const struct sim *sim,
+                            const struct options *opts, uint64_t *last)
+{
+  if (opts->checkpoint_every == 0
+      || sim->step_cnt - *last < opts->checkpoint_every)
+    return;
+  checkpoint_writer_submit (ckp, sim, opts->checkpoint);
+  *last = sim->step_cnt;
+}
 
-  handle_collision(bodies, cnt, 4); 
-  for (int i = 0; i < cnt; i++)
-  {
-    struct body *bdy1 = &bodies[i];
-    bdy1->posX += bdy1->vel_x * dt;
-    bdy1->posY += bdy1->vel_y * dt;
-  }
- 
+/* Hands the state of SIM to TRAJ if OPTS asks for a frame every so
+   many steps and that many have passed since step *LAST.  Headless
+   runs wait for the writer rather than lose frames; in a window
+   frames are dropped instead, and as steps run in batches, they
+   fall on batch ends */
+static void trajectory_due (struct trajectory_writer *traj,
+                            const struct sim *sim,
+                            const struct options *opts, uint64_t *last)
+{
+  if (sim->step_cnt - *last < opts->trajectory_every)
+    return;
+  trajectory_writer_push (traj, sim, opts->headless);
+  *last = sim->step_cnt;
+}
 
+/* Closes TRAJ and reports what was recorded.  Returns false if the
+   file is incomplete */
+static bool trajectory_finish (struct trajectory_writer *traj)
+{
+  bool ok = trajectory_writer_close (traj);
+  printf ("trajectory: %llu frames (%llu dropped), %.2f MB -> %.2f MB\n",
+          (unsigned long long) traj->frames,
+          (unsigned long long) traj->dropped,
+          traj->raw_bytes / 1e6, traj->stored_bytes / 1e6);
+  return ok;
 }
 
-/* Populates list with all bodies that are coll*/
-// static void get_colliding_bodies (struct body *bodies, int cnt)
-// {
-//   for (int i = 0; i < cnt; i++)
-//     {
-//       struct body *bdy1 = &bodies[i];
-//       for (int j = 0; j < cnt; j++)  // Avoid self-collision
-//       {
-//          if (i == j) continue;
-//          struct body *bdy2 = &bodies[j];
-
-//          double dx = bdy1->posX - bdy2->posX;
-//          double dy = bdy1->posY - bdy2->posY;
-//          double dis = get_distance(bdy1, bdy2); // Using square of distance to avoid sqrt
-//          double radi_sum = (bdy1->radius) + (bdy1->radius) + 0; // Square of combined radii
-
-//           if (dis < radi_sum) // Check for collision
-//           {
-//             list_push_front (&collided_bodies, &bdy1->elem);
-//           }
-//         }
-//     }
-// }
-
-
-
-/* Resolves Body Collisions with perfect inelastic collision */
-/*
-Used this wikipedia article to help with the impulse calculation 
-
-https://en.wikipedia.org/wiki/Elastic_collision#:~:text=In%20an%20angle%2Dfree%20representation%2C%20the%20changed%20velocities%20are%20computed%20using%20the%20centers%20x1%20and%20x2%20at%20the%20time%20of%20contact%20as
-*/
-static void handle_collision (struct body *bodies, size_t cnt, size_t steps)
+/* Initializes SCHED from OPTS */
+static void scheduler_init (struct scheduler *sched, const struct options *opts)
 {
-  // get_colliding_bodies (bodies, cnt);
-/* make them random*/
-  for (int i=0;i<cnt;i++){
-    int new = GetRandomValue(0, cnt - 1);
-    struct body c1 = bodies[i];
-    bodies[i] = bodies[new];
-    bodies[new] = c1;
+  sched->rate = opts->rate;
+  sched->max_catchup = opts->max_catchup;
+  sched->accumulator = 0;
+  sched->last = sim_clock ();
+  sched->window_start = sched->last;
+  sched->window_sim = 0;
+  sched->ratio = 0;
+  sched->steps = 0;
 }
 
-  for (int i = 0; i < cnt; i++)
-    {
-      struct body *bdy1 = &bodies[i];
-      // for (int s = 0; s < steps; s++)
-      // {
-      //   bdy1->posX += bdy1->vel_x * (dt / steps);
-      //   bdy1->posY += bdy1->vel_y * (dt / steps);
-
-        for (int j = i + 1; j < cnt; j++)  // Avoid self-collision
-        {
-          if (i == j) continue;
-            struct body *bdy2 = &bodies[j];
-            double gf = 5;
-            double dx = bdy1->posX  - bdy2->posX;
-            double dy = bdy1->posY - bdy2->posY;
-            double dis = get_distance(bdy1, bdy2); // Using square of distance to avoid sqrt
-            double radi_sum = (bdy1->radius) + (0*gf) + (bdy1->radius) + 0; // Square of combined radii
-
-            if (dis < radi_sum) // Check for collision
-          {
-                double dvx = bdy1->vel_x - bdy2->vel_x;
-                double dvy = bdy1->vel_y - bdy2->vel_y;
-                
-                // Check if particles are approaching each other
-                if (dvx * dx + dvy * dy > 0) continue;
-
-                // Coefficient of restitution
-                double eps =  .8; // Can be set to a different value for less elastic collisions
-
-                // Collision response calculations
-                double mass_sum = bdy1->mass + bdy2->mass;
-                double impulse_x = 1 * (2 * dx * (dvx * dx + dvy * dy)) / (dis * mass_sum);
-                double impulse_y = 1 * (2 *  dy * (dvx * dx + dvy * dy)) / (dis * mass_sum);
-                /* 
-                According to Wikipedia
-                v′₁ = 2 * (dx) * (dvx * dx + dvy * dy) / (dis * mass_sum)
-                
-                Impulse:= F × ΔT = m₁Δv 
-                  -But Δv = v′₁ - v₁
-                So F = 
-                F × ΔT = 
-
-                there needs to be a minimum impulse 
-                */
-                bdy1->vel_x -= (impulse_x * dt) / bdy2->mass;
-                bdy1->vel_y -= (impulse_y * dt) / bdy2->mass;
-                bdy2->vel_x += (impulse_x * dt) / bdy1->mass;
-                bdy2->vel_y += (impulse_y * dt) / bdy1->mass;
-                resolve_collision (bdy1, bdy2, dis);
-                
-                  /*
-                  
-                  double dvx = bdy1->vel_x - bdy2->vel_x;
-            double dvy = bdy1->vel_y - bdy2->vel_y;
-             // Check if particles are approaching each other - referenced rebound collision.c
-             if (dvx*dx + dvy*dy > 0) continue; 
-            resolve_collision (bdy1, bdy2, dis);
-              // Momentum conservation for perfectly inelastic collision
-            double vx = (bdy1->mass * bdy1->vel_x + bdy2->mass * bdy2->vel_x) / (bdy1->mass + bdy2->mass);
-            double vy = (bdy1->mass * bdy1->vel_y + bdy2->mass * bdy2->vel_y) / (bdy1->mass + bdy2->mass);
-            bdy1->vel_x = vx;
-            bdy1->vel_y = vy;
-            bdy2->vel_x = vx;
-            bdy2->vel_y = vy;
-                  */
-
-          }
-        // }
-      }
-    }
+/* Runs as many steps of SIM as the wall clock time since the last
+   call pays for, up to the catch-up limit of SCHED */
+static void scheduler_advance (struct scheduler *sched, struct sim *sim)
+{
+  double now = sim_clock ();
+  double step_wall = 1 / sched->rate;
 
-}
+  sched->accumulator += now - sched->last;
+  sched->last = now;
 
+  sched->steps = 0;
+  while (sched->accumulator >= step_wall && sched->steps < sched->max_catchup)
+  {
+    sim_step (sim);
+    sched->accumulator -= step_wall;
+    sched->steps++;
+  }
 
-/* Calculates the distance between the two bodies: BDYA and BDYB */
-static double get_distance (struct body *bdyA, struct body *bdyB)
-{
-  double dx = bdyA->posX - bdyB->posX; 
-  double dy = bdyA->posY - bdyB->posY;
-  double dist = sqrt (dx * dx + dy * dy);
-  double distance_tolerance = .20; /* Smallest distance two objects can be */
-  //return (dist < distance_tolerance) ? distance_tolerance : dist; 
-  return dist;  
-}
+  /* Fallen behind: drop what cannot be caught up */
+  if (sched->accumulator >= step_wall)
+    sched->accumulator = fmod (sched->accumulator, step_wall);
 
-/* 
-   Resolves body collision by body 'BDYA' and body 'BDYB' by positioning both 
-   bodies such that they are not intersecting.
+  sched->window_sim += sched->steps * sim->dt;
+  if (now - sched->window_start >= 1)
+  {
+    sched->ratio = sched->window_sim / (now - sched->window_start);
+    sched->window_start = now;
+    sched->window_sim = 0;
+  }
+}
 
-   References: https://ericleong.me/research/circle-circle/
-*/
-static void resolve_collision(struct body *bdyA, struct body *bdyB, double distance)
+/* Returns the wall clock time until SCHED owes the next step */
+static double scheduler_wait (const struct scheduler *sched)
 {
-  /* Midpoint tells us how far bodies needs 
-     to be pushed to resolve intersection 
-     (i.e collision) */
-  double midpoint_x = (bdyA->posX + bdyB->posX) / 2;
-  double midpoint_y = (bdyA->posY + bdyB->posY) / 2;
-  
-  /* Resolve body overlap */
-  double original_bdyA_x = bdyA->posX;
-  double original_bdyA_y = bdyA->posY;
-  double original_bdyB_x = bdyB->posX;
-  double original_bdyB_y = bdyB->posY;
-  
-  bdyA->posX = midpoint_x + bdyA->radius * (original_bdyA_x - original_bdyB_x) / distance;
-  bdyA->posY = midpoint_y + bdyA->radius * (original_bdyA_y - original_bdyB_y) / distance;
-  bdyB->posX = midpoint_x + bdyB->radius * (original_bdyB_x - original_bdyA_x) / distance;
-  bdyB->posY = midpoint_y + bdyB->radius * (original_bdyB_y - original_bdyA_y) / distance;
+  return 1 / sched->rate - sched->accumulator;
 }
 
 /* Updates CAMERA position from key press events */
@@ -331,4 +775,156 @@ static void handle_camera_pos (Camera2D *_camera)
   if (IsKeyDown (KEY_W)) camera.zoom += .01;
   if (IsKeyDown (KEY_S)) camera.zoom -= .01;
   *_camera = camera;
-}
\ No newline at end of file
+}
+
+/* Forwards force solver, integrator, collision mode and opening
+   angle key presses to the physics thread of PHYS */
+static void handle_solver_keys (struct physics *phys)
+{
+  if (IsKeyPressed (KEY_B))
+    __atomic_fetch_add (&phys->solver_toggles, 1, __ATOMIC_RELAXED);
+  if (IsKeyPressed (KEY_V))
+    __atomic_fetch_add (&phys->integrator_cycles, 1, __ATOMIC_RELAXED);
+  if (IsKeyPressed (KEY_M))
+    __atomic_fetch_add (&phys->collision_toggles, 1, __ATOMIC_RELAXED);
+
+  /* Direct-sum kernel controls */
+  if (IsKeyPressed (KEY_K))
+    __atomic_fetch_add (&phys->isa_cycles, 1, __ATOMIC_RELAXED);
+  if (IsKeyPressed (KEY_P))
+    __atomic_fetch_add (&phys->precision_toggles, 1, __ATOMIC_RELAXED);
+
+  /* Opening angle controls */
+  if (IsKeyPressed (KEY_EQUAL)) __atomic_fetch_add (&phys->theta_steps, 1, __ATOMIC_RELAXED);
+  if (IsKeyPressed (KEY_MINUS)) __atomic_fetch_sub (&phys->theta_steps, 1, __ATOMIC_RELAXED);
+}
+
+/* Switches between instanced and immediate circle drawing from
+   key press events */
+static void handle_render_keys (struct circle_renderer *renderer)
+{
+  if (IsKeyPressed (KEY_I)) renderer->enabled = !renderer->enabled;
+}
+
+/* Forwards a body spawn to the physics thread of PHYS for every
+   left click, at the clicked point seen through CAMERA */
+static void handle_spawn_clicks (struct physics *phys, Camera2D camera)
+{
+  if (!IsMouseButtonPressed (MOUSE_BUTTON_LEFT))
+    return;
+  Vector2 pos = GetScreenToWorld2D (GetMousePosition (), camera);
+  pthread_mutex_lock (&phys->spawn_lock);
+  if (phys->spawn_cnt < 16)
+    phys->spawns[phys->spawn_cnt++] = pos;
+  pthread_mutex_unlock (&phys->spawn_lock);
+}
+
+/* Draws the active force solver of SNAP in the top left corner */
+static void draw_solver_info (const struct snapshot *snap,
+                              const struct circle_renderer *renderer)
+{
+  if (snap->solver == SOLVER_DIRECT)
+    DrawText (TextFormat ("solver: direct [B]  kernel: %s %s [K/P]",
+                          gravity_isa_name (snap->isa),
+                          snap->precision == GRAVITY_FLOAT ? "f32" : "f64"),
+              10, 10, 20, GREEN);
+  else if (snap->solver == SOLVER_SYMMETRIC)
+    DrawText ("solver: symmetric [B]  kernel: scalar f64", 10, 10, 20, GREEN);
+  else
+    DrawText (TextFormat ("solver: barnes-hut [B]  theta: %.1f [-/+]",
+                          snap->theta), 10, 10, 20, GREEN);
+  DrawText (TextFormat ("threads: %d  integrator: %s [V]  softening: %s %g",
+                        snap->thread_cnt,
+                        sim_integrator_name (snap->integrator),
+                        gravity_softening_name (snap->softening), snap->eps),
+            10, 35, 20, GREEN);
+  DrawText (TextFormat ("collisions: %s [M]  pairs: %zu candidates, "
+                        "%zu contacts",
+                        sim_collision_name (snap->collisions),
+                        snap->candidates, snap->contacts),
+            10, 60, 20, GREEN);
+  DrawText (TextFormat ("sim time / wall time: %.2f (target %.2f), step %llu, "
+                        "%zu bodies [click]",
+                        snap->ratio, snap->rate * snap->dt,
+                        (unsigned long long) snap->step_cnt, snap->cnt),
+            10, 85, 20, GREEN);
+  DrawText (TextFormat ("renderer: %s [I]  profiler [F]",
+                        !renderer->instanced ? "immediate (no instancing)"
+                        : renderer->enabled ? "instanced" : "immediate"),
+            10, 110, 20, GREEN);
+  DrawFPS (10, 135);
+}
+
+/* Draws the zone times of the last frames as a stacked histogram
+   in the bottom right corner, with the mean of each zone.  The
+   physics zones run on their own thread and overlap the render
+   zones, so a bar can be taller than its frame. */
+static void draw_profile (void)
+{
+  const int bar_w = 2;
+  const int x0 = SCRNW - 10 - PROFILE_HISTORY * bar_w;
+  const int y0 = SRCHT - 10;
+
+#ifdef NPROFILE
+  DrawText ("profiler compiled out (NPROFILE)", x0, y0 - 10, 10, GRAY);
+#else
+  static const Color colors[PROFILE_HISTOGRAM_CNT] =
+  {
+    [PROFILE_FORCES] = RED,
+    [PROFILE_COLLISIONS] = ORANGE,
+    [PROFILE_KICK] = YELLOW,
+    [PROFILE_DRIFT] = LIME,
+    [PROFILE_SNAPSHOT] = SKYBLUE,
+    [PROFILE_DRAW] = VIOLET,
+    [PROFILE_PRESENT] = GRAY,
+  };
+  static struct profile_history h;
+  const int height = 100;
+
+  profile_get_history (&h);
+
+  /* Scale to the tallest bar, rounded up to 1, 2 or 5 ms times a
+     power of ten */
+  double mean[PROFILE_HISTOGRAM_CNT] = {0};
+  double max = 0;
+  for (int f = 0; f < h.cnt; f++)
+  {
+    double sum = 0;
+    for (int z = 0; z < PROFILE_HISTOGRAM_CNT; z++)
+    {
+      sum += h.ms[f][z];
+      mean[z] += h.ms[f][z] / h.cnt;
+    }
+    if (sum > max) max = sum;
+  }
+  static const double steps[] = {1, 2, 5};
+  double decade = .01;
+  int k = 0;
+  while (decade * steps[k] < max)
+    if (++k == 3)
+    {
+      k = 0;
+      decade *= 10;
+    }
+  double scale = decade * steps[k];
+
+  DrawRectangle (x0, y0 - height, PROFILE_HISTORY * bar_w, height,
+                 (Color) {0, 0, 0, 160});
+  for (int f = 0; f < h.cnt; f++)
+  {
+    double y = y0;
+    for (int z = 0; z < PROFILE_HISTOGRAM_CNT; z++)
+    {
+      double bar = h.ms[f][z] / scale * height;
+      DrawRectangle (x0 + f * bar_w, (int) (y - bar), bar_w,
+                     (int) ceil (bar), colors[z]);
+      y -= bar;
+    }
+  }
+  DrawText (TextFormat ("%g ms", scale), x0, y0 - height - 12, 10, GRAY);
+
+  for (int z = 0; z < PROFILE_HISTOGRAM_CNT; z++)
+    DrawText (TextFormat ("%s %.2f ms", profile_zone_name (z), mean[z]),
+              x0 - 110, y0 - height + 12 * z, 10, colors[z]);
+#endif
+}
@@ -0,0 +1,278 @@
+#define _POSIX_C_SOURCE 200809L
+#include "profile.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "thread_pool.h"
+
+/* Threads that can record trace events: a full pool plus the
+   render, physics and writer threads. */
+#define PROFILE_THREADS_MAX (THREAD_POOL_MAX + 8)
+
+/* Trace event: one run of a zone. */
+struct profile_event
+{
+  uint64_t start;             /* Nanoseconds, see profile_now(). */
+  uint64_t end;
+  int zone;
+};
+
+/* Per-thread trace buffer. */
+struct profile_thread
+{
+  char name[32];
+  int tid;                    /* Track in the trace. */
+  struct profile_event *events;   /* Allocated on first capture. */
+  size_t cnt;
+  uint64_t dropped;           /* Events lost to a full buffer. */
+};
+
+static struct profile_thread *thread_self (void);
+static void write_event (FILE *f, const struct profile_thread *t,
+                         const struct profile_event *e, uint64_t epoch,
+                         bool *first);
+
+/* Zone totals since the last frame, accessed atomically.  Each on
+   its own cache line, as pool workers add to them concurrently. */
+static struct
+{
+  uint64_t ns;
+  char pad[56];
+} totals[PROFILE_ZONE_CNT];
+
+/* Histogram ring, owned by the thread calling profile_frame(). */
+static double ring[PROFILE_HISTORY][PROFILE_HISTOGRAM_CNT];
+static int ring_next;
+static int ring_cnt;
+
+/* Frame counter and trace window [CAPTURE_FIRST, CAPTURE_END) */
+static uint64_t frame;
+static uint64_t frame_start;
+static uint64_t capture_first;
+static uint64_t capture_end;
+static int capturing;       /* Accessed atomically. */
+
+/* Registered threads, protected by LOCK. */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct profile_thread *threads[PROFILE_THREADS_MAX];
+static int thread_cnt;
+
+/* The calling thread's buffer, once it has recorded while
+   capturing, and its name until then. */
+static __thread struct profile_thread *self;
+static __thread char self_name[32];
+
+/* Names of the zones, by enum profile_zone. */
+static const char *const zone_names[PROFILE_ZONE_CNT] =
+{
+  [PROFILE_FORCES] = "forces",
+  [PROFILE_COLLISIONS] = "collisions",
+  [PROFILE_KICK] = "kick",
+  [PROFILE_DRIFT] = "drift",
+  [PROFILE_SNAPSHOT] = "snapshot",
+  [PROFILE_DRAW] = "draw",
+  [PROFILE_PRESENT] = "present",
+  [PROFILE_STEP] = "step",
+  [PROFILE_TASK] = "task",
+  [PROFILE_FRAME] = "frame",
+};
+
+/* Returns a monotonic clock reading in nanoseconds. */
+uint64_t profile_now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/* Ends a run of ZONE that began at START, a profile_now()
+   reading. */
+void profile_record (enum profile_zone zone, uint64_t start)
+{
+  uint64_t end = profile_now ();
+  __atomic_fetch_add (&totals[zone].ns, end - start, __ATOMIC_RELAXED);
+  if (!__atomic_load_n (&capturing, __ATOMIC_RELAXED))
+    return;
+
+  struct profile_thread *t = thread_self ();
+  if (t == NULL)
+    return;
+  if (t->events == NULL)
+    t->events = malloc (PROFILE_EVENTS_MAX * sizeof *t->events);
+  if (t->events == NULL || t->cnt == PROFILE_EVENTS_MAX)
+    {
+      t->dropped++;
+      return;
+    }
+  t->events[t->cnt++] = (struct profile_event) {start, end, zone};
+}
+
+/* Names the calling thread's track in the trace. */
+void profile_thread_name (const char *name)
+{
+  snprintf (self_name, sizeof self_name, "%s", name);
+  if (self != NULL)
+    memcpy (self->name, self_name, sizeof self->name);
+}
+
+/* Ends the current frame: its zone totals go into the histogram
+   and the trace window moves on.  Must always be called from the
+   same thread. */
+void profile_frame (void)
+{
+  uint64_t now = profile_now ();
+  if (frame_start != 0)
+    profile_record (PROFILE_FRAME, frame_start);
+
+  for (int z = 0; z < PROFILE_HISTOGRAM_CNT; z++)
+    ring[ring_next][z] = __atomic_exchange_n (&totals[z].ns, 0,
+                                              __ATOMIC_RELAXED) / 1e6;
+  ring_next = (ring_next + 1) % PROFILE_HISTORY;
+  if (ring_cnt < PROFILE_HISTORY)
+    ring_cnt++;
+
+  frame++;
+  frame_start = now;
+  __atomic_store_n (&capturing, frame >= capture_first && frame < capture_end,
+                    __ATOMIC_RELAXED);
+}
+
+/* Copies the histogram into *H, oldest frame first.  Must be called
+   from the thread that calls profile_frame(). */
+void profile_get_history (struct profile_history *h)
+{
+  h->cnt = ring_cnt;
+  for (int i = 0; i < ring_cnt; i++)
+    {
+      int k = (ring_next - ring_cnt + i + PROFILE_HISTORY) % PROFILE_HISTORY;
+      memcpy (h->ms[i], ring[k], sizeof h->ms[i]);
+    }
+}
+
+/* Returns the name of ZONE. */
+const char *profile_zone_name (enum profile_zone zone)
+{
+  return (zone < PROFILE_ZONE_CNT) ? zone_names[zone] : "?";
+}
+
+/* Records trace events from frame FIRST, counting from 0, for CNT
+   frames.  Must be called from the thread that calls
+   profile_frame(). */
+void profile_capture (uint64_t first, uint64_t cnt)
+{
+  capture_first = first;
+  capture_end = first + cnt;
+  __atomic_store_n (&capturing, frame >= capture_first && frame < capture_end,
+                    __ATOMIC_RELAXED);
+}
+
+/* Writes the captured events to PATH as a Chrome trace.  Every
+   thread that recorded events must be idle.  Returns false, after
+   printing why, if PATH cannot be written. */
+bool profile_write_trace (const char *path)
+{
+  FILE *f = fopen (path, "w");
+  if (f == NULL)
+    {
+      fprintf (stderr, "profile: cannot open %s\n", path);
+      return false;
+    }
+
+  pthread_mutex_lock (&lock);
+  uint64_t epoch = UINT64_MAX;
+  size_t events = 0;
+  uint64_t dropped = 0;
+  for (int i = 0; i < thread_cnt; i++)
+    {
+      const struct profile_thread *t = threads[i];
+      for (size_t e = 0; e < t->cnt; e++)
+        if (t->events[e].start < epoch)
+          epoch = t->events[e].start;
+      events += t->cnt;
+      dropped += t->dropped;
+    }
+
+  bool first = true;
+  fprintf (f, "{\"displayTimeUnit\": \"ms\",\n \"traceEvents\": [");
+  for (int i = 0; i < thread_cnt; i++)
+    {
+      const struct profile_thread *t = threads[i];
+      fprintf (f, "%s\n  {\"name\": \"thread_name\", \"ph\": \"M\", "
+               "\"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+               first ? "" : ",", t->tid, t->name);
+      first = false;
+      for (size_t e = 0; e < t->cnt; e++)
+        write_event (f, t, &t->events[e], epoch, &first);
+    }
+  fprintf (f, "\n ],\n \"otherData\": {\"dropped\": %llu}}\n",
+           (unsigned long long) dropped);
+  int threads_seen = thread_cnt;
+  pthread_mutex_unlock (&lock);
+
+  bool ok = !ferror (f);
+  if (fclose (f) != 0)
+    ok = false;
+  if (!ok)
+    fprintf (stderr, "profile: cannot write %s\n", path);
+  else
+    printf ("profile: %zu events (%llu dropped) from %d threads to %s\n",
+            events, (unsigned long long) dropped, threads_seen, path);
+  return ok;
+}
+
+/* Frees every trace buffer.  No thread may record afterwards. */
+void profile_shutdown (void)
+{
+  pthread_mutex_lock (&lock);
+  for (int i = 0; i < thread_cnt; i++)
+    {
+      free (threads[i]->events);
+      free (threads[i]);
+    }
+  thread_cnt = 0;
+  pthread_mutex_unlock (&lock);
+  self = NULL;
+}
+
+/* Returns the calling thread's trace buffer, registering it on
+   first use, or NULL if too many threads have registered. */
+static struct profile_thread *thread_self (void)
+{
+  if (self != NULL)
+    return self;
+
+  struct profile_thread *t = calloc (1, sizeof *t);
+  if (t == NULL)
+    return NULL;
+  pthread_mutex_lock (&lock);
+  if (thread_cnt == PROFILE_THREADS_MAX)
+    {
+      pthread_mutex_unlock (&lock);
+      free (t);
+      return NULL;
+    }
+  t->tid = thread_cnt + 1;
+  if (self_name[0] != '\0')
+    memcpy (t->name, self_name, sizeof t->name);
+  else
+    snprintf (t->name, sizeof t->name, "thread %d", t->tid);
+  threads[thread_cnt++] = t;
+  pthread_mutex_unlock (&lock);
+  self = t;
+  return t;
+}
+
+/* Writes event E of thread T to F as a complete event, with times
+   in microseconds since EPOCH */
+static void write_event (FILE *f, const struct profile_thread *t,
+                         const struct profile_event *e, uint64_t epoch,
+                         bool *first)
+{
+  fprintf (f, "%s\n  {\"name\": \"%s\", \"cat\": \"n-body\", \"ph\": \"X\", "
+           "\"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+           *first ? "" : ",", zone_names[e->zone], t->tid,
+           (e->start - epoch) / 1e3, (e->end - e->start) / 1e3);
+  *first = false;
+}
@@ -0,0 +1,73 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Frame profiler.
+
+   PROFILE_BEGIN (Z) and PROFILE_END (Z) bracket a timing zone, a
+   phase of the work, on any thread.  Every zone adds its duration
+   to a per-zone total; profile_frame(), called once per frame,
+   moves the totals into a history of the last PROFILE_HISTORY
+   frames, which the window draws as a rolling histogram.
+
+   Between profile_capture() and the end of the frame window it
+   names, every zone is also appended to a buffer of the thread it
+   ran on, and profile_write_trace() writes the buffers out as a
+   Chrome trace-event file (chrome://tracing, Perfetto), one track
+   per thread.
+
+   A zone costs two clock reads and an atomic add, plus a store
+   while capturing.  Defining NPROFILE compiles every zone out, as
+   NDEBUG does assert(). */
+
+#define PROFILE_HISTORY 120       /* Frames kept for the histogram. */
+#define PROFILE_EVENTS_MAX 65536  /* Trace events per thread. */
+
+/* Timing zones. */
+enum profile_zone
+{
+  /* Shown in the histogram, stacked in this order */
+  PROFILE_FORCES,             /* Force evaluation. */
+  PROFILE_COLLISIONS,         /* Collision handling. */
+  PROFILE_KICK,               /* Velocity updates. */
+  PROFILE_DRIFT,              /* Position updates. */
+  PROFILE_SNAPSHOT,           /* Publishing a snapshot. */
+  PROFILE_DRAW,               /* Drawing bodies and overlay. */
+  PROFILE_PRESENT,            /* EndDrawing(): swap and frame pacing. */
+  PROFILE_HISTOGRAM_CNT,
+
+  /* Trace only, as they contain or overlap the zones above */
+  PROFILE_STEP = PROFILE_HISTOGRAM_CNT,   /* One sim_step(). */
+  PROFILE_TASK,               /* One thread's slice of a pool job. */
+  PROFILE_FRAME,              /* One frame. */
+  PROFILE_ZONE_CNT
+};
+
+#ifndef NPROFILE
+#define PROFILE_BEGIN(ZONE) uint64_t profile_start_##ZONE = profile_now ()
+#define PROFILE_END(ZONE) profile_record (ZONE, profile_start_##ZONE)
+#else
+#define PROFILE_BEGIN(ZONE) ((void) 0)
+#define PROFILE_END(ZONE) ((void) 0)
+#endif
+
+/* Zone durations of the last frames, oldest first. */
+struct profile_history
+{
+  int cnt;                    /* Frames, up to PROFILE_HISTORY. */
+  double ms[PROFILE_HISTORY][PROFILE_HISTOGRAM_CNT];
+};
+
+uint64_t profile_now (void);
+void profile_record (enum profile_zone, uint64_t start);
+void profile_thread_name (const char *);
+void profile_frame (void);
+void profile_get_history (struct profile_history *);
+const char *profile_zone_name (enum profile_zone);
+void profile_capture (uint64_t first, uint64_t cnt);
+bool profile_write_trace (const char *path);
+void profile_shutdown (void);
+
+#endif /* profile.h */
@@ -0,0 +1,317 @@
+#include "quadtree.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Deepest level a body is pushed down to.  Bodies that still
+   share a cell at this depth (i.e. nearly coincide) are chained
+   together in one leaf and handled pairwise. */
+#define QT_MAX_DEPTH 48
+
+/* Worst case size of the traversal stack: every level pops one
+   node and pushes at most four. */
+#define QT_STACK_SIZE (3 * QT_MAX_DEPTH + 4)
+
+static int new_node (struct quadtree *qt, double cx, double cy, double half);
+static int get_child (struct quadtree *qt, int node, int quad);
+static void insert_body (struct quadtree *qt,
+                         const struct body_store *store, int b);
+
+/* Returns the quadrant of the cell centered on CX, CY that
+   contains point X, Y. */
+static inline int quadrant_of (double cx, double cy, double x, double y)
+{
+  return (x >= cx) | ((y >= cy) << 1);
+}
+
+/* Returns true if node N has no children. */
+static inline bool is_leaf (const struct qt_node *n)
+{
+  return n->child[0] < 0 && n->child[1] < 0 && n->child[2] < 0
+         && n->child[3] < 0;
+}
+
+/* Initializes QT as an empty tree with opening angle THETA. */
+void quadtree_init (struct quadtree *qt, double theta)
+{
+  assert (qt != NULL);
+  qt->nodes = NULL;
+  qt->node_cnt = 0;
+  qt->node_cap = 0;
+  qt->next_body = NULL;
+  qt->body_cap = 0;
+  qt->theta = theta;
+  quadtree_set_softening (qt, GRAVITY_SOFT_NONE, 0);
+}
+
+/* Frees the memory held by QT. */
+void quadtree_destroy (struct quadtree *qt)
+{
+  assert (qt != NULL);
+  free (qt->nodes);
+  free (qt->next_body);
+  enum gravity_softening softening = qt->softening;
+  double eps = qt->eps;
+  quadtree_init (qt, qt->theta);
+  quadtree_set_softening (qt, softening, eps);
+}
+
+/* Makes QT soften interactions with law SOFTENING and length EPS.
+   A softening law with EPS <= 0 falls back to the plain law. */
+void quadtree_set_softening (struct quadtree *qt,
+                             enum gravity_softening softening, double eps)
+{
+  if (eps <= 0 || softening >= GRAVITY_SOFT_CNT)
+    {
+      softening = GRAVITY_SOFT_NONE;
+      eps = 0;
+    }
+  qt->softening = softening;
+  qt->eps = eps;
+  qt->eps2 = eps * eps;
+  qt->inv_eps4 = (eps > 0) ? 1 / (qt->eps2 * qt->eps2) : 0;
+}
+
+/* Rebuilds QT from the bodies in STORE. */
+void quadtree_build (struct quadtree *qt, const struct body_store *store)
+{
+  assert (qt != NULL);
+  size_t cnt = store->cnt;
+  qt->node_cnt = 0;
+  if (cnt == 0)
+    return;
+
+  if (qt->body_cap < cnt)
+    {
+      int *next = realloc (qt->next_body, cnt * sizeof *next);
+      if (next == NULL)
+        {
+          fprintf (stderr, "quadtree: out of memory\n");
+          exit (1);
+        }
+      qt->next_body = next;
+      qt->body_cap = cnt;
+    }
+
+  /* Root cell is the bounding square of all bodies. */
+  const double *pos_x = store->pos_x;
+  const double *pos_y = store->pos_y;
+  double min_x = pos_x[0], max_x = pos_x[0];
+  double min_y = pos_y[0], max_y = pos_y[0];
+  for (size_t i = 1; i < cnt; i++)
+    {
+      if (pos_x[i] < min_x) min_x = pos_x[i];
+      if (pos_x[i] > max_x) max_x = pos_x[i];
+      if (pos_y[i] < min_y) min_y = pos_y[i];
+      if (pos_y[i] > max_y) max_y = pos_y[i];
+    }
+  double half = (max_x - min_x > max_y - min_y ? max_x - min_x
+                                               : max_y - min_y) / 2;
+  half = half * 1.001 + 1e-9;
+  new_node (qt, (min_x + max_x) / 2, (min_y + max_y) / 2, half);
+
+  for (size_t i = 0; i < cnt; i++)
+    insert_body (qt, store, i);
+
+  /* Turn the mass-weighted position sums into centers of mass. */
+  for (size_t i = 0; i < qt->node_cnt; i++)
+    {
+      struct qt_node *n = &qt->nodes[i];
+      if (n->mass > 0)
+        {
+          n->com_x /= n->mass;
+          n->com_y /= n->mass;
+        }
+    }
+}
+
+/* Body of quadtree_accel(), specialised on softening law SOFT. */
+static inline __attribute__ ((always_inline)) size_t
+walk (const struct quadtree *qt, const struct body_store *store,
+      size_t idx, double *ax, double *ay, enum gravity_softening soft)
+{
+  if (qt->node_cnt == 0)
+    return 0;
+
+  int stack[QT_STACK_SIZE];
+  int sp = 0;
+  const double *pos_x = store->pos_x;
+  const double *pos_y = store->pos_y;
+  const double *mass = store->mass;
+  double x = pos_x[idx];
+  double y = pos_y[idx];
+  double theta2 = qt->theta * qt->theta;
+  double eps2 = qt->eps2;
+  double inv_eps4 = qt->inv_eps4;
+  double acc_x = 0;
+  double acc_y = 0;
+  size_t interactions = 0;
+
+  stack[sp++] = 0;
+  while (sp > 0)
+    {
+      const struct qt_node *n = &qt->nodes[stack[--sp]];
+      if (n->mass == 0)
+        continue;
+
+      if (is_leaf (n))
+        {
+          /* Leaves are summed exactly, skipping the body itself. */
+          for (int b = n->body; b >= 0; b = qt->next_body[b])
+            {
+              if ((size_t) b == idx)
+                continue;
+              double dx = pos_x[b] - x;
+              double dy = pos_y[b] - y;
+              double f = mass[b] * gravity_soft_factor (soft,
+                                                         dx * dx + dy * dy,
+                                                         eps2, inv_eps4);
+              acc_x += f * dx;
+              acc_y += f * dy;
+              interactions++;
+            }
+          continue;
+        }
+
+      double dx = n->com_x - x;
+      double dy = n->com_y - y;
+      double r = dx * dx + dy * dy;
+      double width = 2 * n->half;
+      bool inside = x >= n->cx - n->half && x < n->cx + n->half
+                    && y >= n->cy - n->half && y < n->cy + n->half;
+
+      /* Far enough away: use the node's center of mass. */
+      if (!inside && width * width < theta2 * r)
+        {
+          double f = n->mass * gravity_soft_factor (soft, r, eps2, inv_eps4);
+          acc_x += f * dx;
+          acc_y += f * dy;
+          interactions++;
+          continue;
+        }
+
+      for (int q = 0; q < 4; q++)
+        if (n->child[q] >= 0)
+          stack[sp++] = n->child[q];
+    }
+
+  *ax += acc_x;
+  *ay += acc_y;
+  return interactions;
+}
+
+/* Adds the acceleration that all bodies in QT exert on body IDX
+   of STORE to *AX and *AY, and returns the number of bodies and
+   nodes that contributed.  QT must have been built from STORE. */
+size_t quadtree_accel (const struct quadtree *qt,
+                       const struct body_store *store, size_t idx,
+                       double *ax, double *ay)
+{
+  switch (qt->softening)
+    {
+      case GRAVITY_SOFT_PLUMMER:
+        return walk (qt, store, idx, ax, ay, GRAVITY_SOFT_PLUMMER);
+      case GRAVITY_SOFT_SPLINE:
+        return walk (qt, store, idx, ax, ay, GRAVITY_SOFT_SPLINE);
+      default:
+        return walk (qt, store, idx, ax, ay, GRAVITY_SOFT_NONE);
+    }
+}
+
+/* Appends an empty node for the cell centered on CX, CY with
+   half width HALF to QT and returns its index. */
+static int new_node (struct quadtree *qt, double cx, double cy, double half)
+{
+  if (qt->node_cnt == qt->node_cap)
+    {
+      size_t cap = qt->node_cap ? qt->node_cap * 2 : 1024;
+      struct qt_node *nodes = realloc (qt->nodes, cap * sizeof *nodes);
+      if (nodes == NULL)
+        {
+          fprintf (stderr, "quadtree: out of memory\n");
+          exit (1);
+        }
+      qt->nodes = nodes;
+      qt->node_cap = cap;
+    }
+
+  struct qt_node *n = &qt->nodes[qt->node_cnt];
+  n->cx = cx;
+  n->cy = cy;
+  n->half = half;
+  n->mass = 0;
+  n->com_x = 0;
+  n->com_y = 0;
+  n->child[0] = n->child[1] = n->child[2] = n->child[3] = -1;
+  n->body = -1;
+  return qt->node_cnt++;
+}
+
+/* Returns the child of NODE in quadrant QUAD, creating it if it
+   does not exist yet.  May move the node pool. */
+static int get_child (struct quadtree *qt, int node, int quad)
+{
+  if (qt->nodes[node].child[quad] >= 0)
+    return qt->nodes[node].child[quad];
+
+  double h = qt->nodes[node].half / 2;
+  double cx = qt->nodes[node].cx + ((quad & 1) ? h : -h);
+  double cy = qt->nodes[node].cy + ((quad & 2) ? h : -h);
+  int c = new_node (qt, cx, cy, h);
+  qt->nodes[node].child[quad] = c;
+  return c;
+}
+
+/* Inserts body B of STORE into QT, adding its mass to every
+   node on the way down. */
+static void insert_body (struct quadtree *qt,
+                         const struct body_store *store, int b)
+{
+  const double *pos_x = store->pos_x;
+  const double *pos_y = store->pos_y;
+  const double *mass = store->mass;
+  int node = 0;
+  int depth = 0;
+
+  for (;;)
+    {
+      struct qt_node *n = &qt->nodes[node];
+      n->mass += mass[b];
+      n->com_x += mass[b] * pos_x[b];
+      n->com_y += mass[b] * pos_y[b];
+
+      if (is_leaf (n))
+        {
+          if (n->body < 0)
+            {
+              n->body = b;
+              qt->next_body[b] = -1;
+              return;
+            }
+          if (depth >= QT_MAX_DEPTH)
+            {
+              qt->next_body[b] = n->body;
+              n->body = b;
+              return;
+            }
+
+          /* Occupied leaf: push its body one level down. */
+          int old = n->body;
+          n->body = -1;
+          int c = get_child (qt, node, quadrant_of (n->cx, n->cy,
+                                                    pos_x[old], pos_y[old]));
+          struct qt_node *child = &qt->nodes[c];
+          child->body = old;
+          child->mass = mass[old];
+          child->com_x = mass[old] * pos_x[old];
+          child->com_y = mass[old] * pos_y[old];
+        }
+
+      n = &qt->nodes[node];
+      node = get_child (qt, node, quadrant_of (n->cx, n->cy,
+                                               pos_x[b], pos_y[b]));
+      depth++;
+    }
+}
+
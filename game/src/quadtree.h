@@ -0,0 +1,74 @@
+#ifndef QUADTREE_H
+#define QUADTREE_H
+#include <stddef.h>
+#include "body.h"
+#include "gravity.h"
+
+/* Barnes-Hut quadtree.
+
+   The tree is rebuilt from scratch every step with
+   quadtree_build().  Every internal node stores the total mass
+   and center of mass of the bodies below it, so that a distant
+   group of bodies can be treated as a single point mass by
+   quadtree_accel().
+
+   Whether a node is "distant" is decided by the opening angle
+   THETA: a node of width S at distance D from the body is used
+   as a whole when S / D < THETA.  THETA = 0 opens every node and
+   reproduces the direct sum; larger values are faster but less
+   accurate.  Values around 0.5 are the usual compromise.
+
+   Both body and node interactions are softened with the law set
+   by quadtree_set_softening(); the walk is instantiated once per
+   law, like the direct kernels.
+
+   Nodes live in one growable array and refer to each other by
+   index, so rebuilding the tree does not touch the allocator
+   once the array has grown large enough. */
+
+/* Default opening angle. */
+#define QT_DEFAULT_THETA 0.5
+
+/* Quadtree node. */
+struct qt_node
+{
+  double cx;            /* Center of the square cell. */
+  double cy;
+  double half;          /* Half of the cell width. */
+
+  double mass;          /* Total mass of the bodies in the cell. */
+  double com_x;         /* Center of mass of the bodies in the cell. */
+  double com_y;
+
+  int child[4];         /* Child node indices, -1 if absent. */
+  int body;             /* First body of a leaf, -1 if empty or internal. */
+};
+
+/* Quadtree. */
+struct quadtree
+{
+  struct qt_node *nodes;  /* Node pool, nodes[0] is the root. */
+  size_t node_cnt;        /* Nodes in use. */
+  size_t node_cap;        /* Nodes allocated. */
+
+  int *next_body;         /* Chains bodies sharing a leaf. */
+  size_t body_cap;        /* Entries allocated in NEXT_BODY. */
+
+  double theta;           /* Opening angle. */
+
+  enum gravity_softening softening;
+  double eps;             /* Softening length. */
+  double eps2;
+  double inv_eps4;
+};
+
+void quadtree_init (struct quadtree *, double theta);
+void quadtree_destroy (struct quadtree *);
+void quadtree_set_softening (struct quadtree *, enum gravity_softening,
+                             double eps);
+
+void quadtree_build (struct quadtree *, const struct body_store *);
+size_t quadtree_accel (const struct quadtree *, const struct body_store *,
+                       size_t idx, double *ax, double *ay);
+
+#endif /* quadtree.h */
@@ -0,0 +1,198 @@
+#include "render.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "rlgl.h"
+#include "raymath.h"
+
+static void load_instance_vbo (struct circle_renderer *r, size_t cap);
+static void draw_immediate (const struct snapshot *snap);
+static void *grow (void *p, size_t cnt, size_t size);
+
+/* Expands each instance's unit quad to its circle's bounding
+   square. */
+static const char *vertex_shader =
+  "#version 330\n"
+  "in vec2 corner;\n"
+  "in vec3 center;\n"           /* x, y, radius */
+  "in vec4 color;\n"
+  "uniform mat4 mvp;\n"
+  "out vec2 local;\n"
+  "out vec4 tint;\n"
+  "void main ()\n"
+  "{\n"
+  "  local = corner;\n"
+  "  tint = color;\n"
+  "  gl_Position = mvp * vec4 (center.xy + corner * center.z, 0.0, 1.0);\n"
+  "}\n";
+
+/* Keeps the pixels inside the unit circle. */
+static const char *fragment_shader =
+  "#version 330\n"
+  "in vec2 local;\n"
+  "in vec4 tint;\n"
+  "out vec4 finalColor;\n"
+  "void main ()\n"
+  "{\n"
+  "  if (dot (local, local) > 1.0)\n"
+  "    discard;\n"
+  "  finalColor = tint;\n"
+  "}\n";
+
+/* Two triangles covering -1..1 in both axes. */
+static const float quad[12] =
+  {
+    -1, -1,  1, -1,  1, 1,
+    -1, -1,  1,  1, -1, 1,
+  };
+
+/* Initializes R and builds the instanced pipeline if the OpenGL
+   context supports it.  Needs an open window. */
+void circle_renderer_init (struct circle_renderer *r)
+{
+  assert (r != NULL);
+  r->instanced = false;
+  r->enabled = true;
+  r->vao = 0;
+  r->quad_vbo = 0;
+  r->instance_vbo = 0;
+  r->vbo_cap = 0;
+  r->instances = NULL;
+  r->cap = 0;
+
+  int version = rlGetVersion ();
+  if (version != RL_OPENGL_33 && version != RL_OPENGL_43)
+    return;
+
+  r->shader = LoadShaderFromMemory (vertex_shader, fragment_shader);
+  if (r->shader.id == 0 || r->shader.id == rlGetShaderIdDefault ())
+    return;
+  r->mvp_loc = rlGetLocationUniform (r->shader.id, "mvp");
+  r->corner_loc = rlGetLocationAttrib (r->shader.id, "corner");
+  r->center_loc = rlGetLocationAttrib (r->shader.id, "center");
+  r->color_loc = rlGetLocationAttrib (r->shader.id, "color");
+  if (r->corner_loc < 0 || r->center_loc < 0 || r->color_loc < 0)
+  {
+    UnloadShader (r->shader);
+    return;
+  }
+
+  r->vao = rlLoadVertexArray ();
+  rlEnableVertexArray (r->vao);
+  r->quad_vbo = rlLoadVertexBuffer (quad, sizeof quad, false);
+  rlSetVertexAttribute (r->corner_loc, 2, RL_FLOAT, false, 0, 0);
+  rlEnableVertexAttribute (r->corner_loc);
+  rlDisableVertexArray ();
+
+  load_instance_vbo (r, 1024);
+  r->instanced = true;
+}
+
+/* Frees the GPU and CPU resources held by R. */
+void circle_renderer_destroy (struct circle_renderer *r)
+{
+  assert (r != NULL);
+  if (r->instanced)
+  {
+    rlUnloadVertexBuffer (r->instance_vbo);
+    rlUnloadVertexBuffer (r->quad_vbo);
+    rlUnloadVertexArray (r->vao);
+    UnloadShader (r->shader);
+  }
+  free (r->instances);
+  r->instances = NULL;
+  r->cap = 0;
+  r->instanced = false;
+}
+
+/* Draws every body of SNAP with R.  Must be called between
+   BeginMode2D() and EndMode2D(). */
+void circle_renderer_draw (struct circle_renderer *r,
+                           const struct snapshot *snap)
+{
+  size_t cnt = snap->cnt;
+
+  if (!r->instanced || !r->enabled)
+  {
+    draw_immediate (snap);
+    return;
+  }
+  if (cnt == 0)
+    return;
+
+  if (r->cap < cnt)
+  {
+    r->instances = grow (r->instances, cnt, sizeof *r->instances);
+    r->cap = cnt;
+  }
+  for (size_t i = 0; i < cnt; i++)
+  {
+    struct circle_instance *inst = &r->instances[i];
+    inst->x = snap->pos_x[i];
+    inst->y = snap->pos_y[i];
+    inst->radius = snap->radius[i];
+    inst->color = snap->color[i];
+  }
+
+  if (r->vbo_cap < cnt)
+  {
+    rlUnloadVertexBuffer (r->instance_vbo);
+    load_instance_vbo (r, cnt + cnt / 2);
+  }
+  rlUpdateVertexBuffer (r->instance_vbo, r->instances,
+                        (int) (cnt * sizeof *r->instances), 0);
+
+  /* Whatever rlgl has batched so far must land underneath */
+  rlDrawRenderBatchActive ();
+
+  Matrix mvp = MatrixMultiply (rlGetMatrixModelview (),
+                               rlGetMatrixProjection ());
+  rlEnableShader (r->shader.id);
+  rlSetUniformMatrix (r->mvp_loc, mvp);
+  rlEnableVertexArray (r->vao);
+  rlDrawVertexArrayInstanced (0, 6, (int) cnt);
+  rlDisableVertexArray ();
+  rlDisableShader ();
+}
+
+/* Replaces the instance buffer of R with an empty one of CAP
+   instances and points the per-instance attributes at it. */
+static void load_instance_vbo (struct circle_renderer *r, size_t cap)
+{
+  int stride = sizeof (struct circle_instance);
+
+  rlEnableVertexArray (r->vao);
+  r->instance_vbo = rlLoadVertexBuffer (NULL, (int) (cap * stride), true);
+  rlSetVertexAttribute (r->center_loc, 3, RL_FLOAT, false, stride, 0);
+  rlSetVertexAttributeDivisor (r->center_loc, 1);
+  rlEnableVertexAttribute (r->center_loc);
+  rlSetVertexAttribute (r->color_loc, 4, RL_UNSIGNED_BYTE, true, stride,
+                        (void *) offsetof (struct circle_instance, color));
+  rlSetVertexAttributeDivisor (r->color_loc, 1);
+  rlEnableVertexAttribute (r->color_loc);
+  rlDisableVertexArray ();
+  r->vbo_cap = cap;
+}
+
+/* Draws every body of SNAP through rlgl's immediate-mode batch */
+static void draw_immediate (const struct snapshot *snap)
+{
+  size_t cnt = snap->cnt;
+  while (cnt--)
+  {
+    DrawCircle (snap->pos_x[cnt], snap->pos_y[cnt], snap->radius[cnt],
+                snap->color[cnt]);
+  }
+}
+
+/* Resizes P to CNT elements of SIZE bytes, exiting on failure. */
+static void *grow (void *p, size_t cnt, size_t size)
+{
+  p = realloc (p, cnt * size);
+  if (p == NULL)
+  {
+    fprintf (stderr, "render: out of memory\n");
+    exit (1);
+  }
+  return p;
+}
@@ -0,0 +1,56 @@
+#ifndef RENDER_H
+#define RENDER_H
+#include <stdbool.h>
+#include <stddef.h>
+#include "raylib.h"
+#include "snapshot.h"
+
+/* Instanced body renderer.
+
+   DrawCircle() tessellates every body into 36 triangles and feeds
+   them vertex by vertex into rlgl's immediate-mode batch, which is
+   flushed many times per frame once there are a few hundred
+   bodies.  This renderer instead uploads one 16-byte record per
+   body (position, radius, colour) into a vertex buffer and draws
+   all of them with a single instanced call: each instance is a
+   quad, and the fragment shader discards the pixels outside the
+   circle.  Draw cost is then one buffer upload plus one draw call,
+   whatever the body count.
+
+   Instancing needs OpenGL 3.3.  Where it is missing, or the shader
+   fails to build, circle_renderer_draw() falls back to one
+   DrawCircle() per body. */
+
+/* Per-body instance record, as uploaded. */
+struct circle_instance
+{
+  float x, y;
+  float radius;
+  Color color;
+};
+
+/* Circle renderer. */
+struct circle_renderer
+{
+  bool instanced;             /* Instanced path is available. */
+  bool enabled;               /* Use it when available. */
+
+  Shader shader;
+  int mvp_loc;
+  int corner_loc;
+  int center_loc;
+  int color_loc;
+  unsigned int vao;
+  unsigned int quad_vbo;      /* One quad, two triangles. */
+  unsigned int instance_vbo;
+  size_t vbo_cap;             /* Instances INSTANCE_VBO holds. */
+
+  struct circle_instance *instances;   /* Staging copy. */
+  size_t cap;
+};
+
+void circle_renderer_init (struct circle_renderer *);
+void circle_renderer_destroy (struct circle_renderer *);
+void circle_renderer_draw (struct circle_renderer *, const struct snapshot *);
+
+#endif /* render.h */
@@ -0,0 +1,71 @@
+#ifndef RNG_H
+#define RNG_H
+#include <stdint.h>
+
+/* Counter-based random numbers.
+
+   The K-th number of a stream is a hash of the stream key and K,
+   so drawing it needs no shared state: any thread can produce any
+   part of a stream, and a run can be replayed exactly from its
+   seed and step count.  A stream is identified by the simulation
+   seed, a fixed purpose (one of enum rng_purpose) and an index
+   such as the step number or a body index.
+
+   The hash is the SplitMix64 finalizer, which is fast and passes
+   the usual statistical test batteries for this use. */
+
+/* What a stream is used for, so that different uses of the same
+   seed never see correlated numbers. */
+enum rng_purpose
+{
+  RNG_COLLISION_ORDER = 1,
+  RNG_INITIAL_CONDITIONS,
+};
+
+/* Random number stream. */
+struct rng
+{
+  uint64_t key;
+  uint64_t counter;
+};
+
+/* SplitMix64 finalizer. */
+static inline uint64_t rng_mix (uint64_t x)
+{
+  x ^= x >> 30;
+  x *= 0xBF58476D1CE4E5B9ull;
+  x ^= x >> 27;
+  x *= 0x94D049BB133111EBull;
+  x ^= x >> 31;
+  return x;
+}
+
+/* Returns stream INDEX of PURPOSE for SEED. */
+static inline struct rng rng_stream (uint64_t seed, enum rng_purpose purpose,
+                                     uint64_t index)
+{
+  struct rng r;
+  r.key = rng_mix (rng_mix (seed + 0x9E3779B97F4A7C15ull * purpose) ^ index);
+  r.counter = 0;
+  return r;
+}
+
+/* Returns the next 64 random bits of R. */
+static inline uint64_t rng_next (struct rng *r)
+{
+  return rng_mix (r->key + 0x9E3779B97F4A7C15ull * ++r->counter);
+}
+
+/* Returns a random integer in 0..BOUND - 1. */
+static inline uint32_t rng_below (struct rng *r, uint32_t bound)
+{
+  return (uint32_t) (((rng_next (r) >> 32) * (uint64_t) bound) >> 32);
+}
+
+/* Returns a random double in [0, 1). */
+static inline double rng_uniform (struct rng *r)
+{
+  return (rng_next (r) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+#endif /* rng.h */
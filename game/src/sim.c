@@ -0,0 +1,897 @@
+#define _POSIX_C_SOURCE 200809L
+#include "sim.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include "rng.h"
+#include "profile.h"
+
+/* Static Functions */
+static void force_task (void *sim_, size_t begin, size_t end, int worker);
+static void pairs_task (void *sim_, size_t begin, size_t end, int worker);
+static void reduce_task (void *sim_, size_t begin, size_t end, int worker);
+static void kick_task (void *sim_, size_t begin, size_t end, int worker);
+static void drift_task (void *sim_, size_t begin, size_t end, int worker);
+static void kick_drift_task (void *sim_, size_t begin, size_t end, int worker);
+static void compute_forces (struct sim *sim);
+static void clear_interactions (struct sim *sim);
+static void kick (struct sim *sim, double h);
+static void drift (struct sim *sim, double h);
+static void block_alloc (struct block_steps *blk, size_t cnt);
+static void step_euler (struct sim *sim);
+static void step_leapfrog (struct sim *sim);
+static void step_verlet (struct sim *sim);
+static void step_yoshida (struct sim *sim);
+static void step_block (struct sim *sim);
+static void block_select (struct sim *sim, uint64_t tick);
+static void block_forces (struct sim *sim);
+static void block_kick (struct sim *sim, thread_pool_task *task);
+static void block_force_task (void *sim_, size_t begin, size_t end, int worker);
+static void block_open_task (void *sim_, size_t begin, size_t end, int worker);
+static void block_close_task (void *sim_, size_t begin, size_t end, int worker);
+static void handle_collision (struct sim *sim);
+static void merge_bodies (struct sim *sim);
+static void merge_pair (struct body_store *bodies, size_t a, size_t b);
+
+/* Initializes SIM with CNT bodies drawn from MODEL, time step DT,
+   random SEED and THREAD_CNT threads (0 for the default). */
+void sim_init (struct sim *sim, size_t cnt, enum ic_model model, double dt,
+               uint64_t seed, int thread_cnt)
+{
+  thread_pool_init (&sim->pool, thread_cnt);
+  body_store_init (&sim->bodies, cnt);
+  ic_generate (&sim->bodies, model, seed, &sim->pool);
+  sim->dt = dt;
+  sim->seed = seed;
+  sim->step_cnt = 0;
+  sim->integrator = INTEGRATOR_EULER;
+  sim->acc_fresh = false;
+  sim->kick_dt = 0;
+  sim->drift_dt = 0;
+
+  struct block_steps *blk = &sim->block;
+  blk->max_level = 6;
+  blk->eta = .05;
+  blk->primed = false;
+  blk->level = NULL;
+  blk->prev_acc_x = NULL;
+  blk->prev_acc_y = NULL;
+  blk->active = NULL;
+  block_alloc (blk, cnt);
+  blk->active_cnt = 0;
+  blk->tick = 0;
+  blk->active_sum = 0;
+
+  sim->solver = SOLVER_BARNES_HUT;
+  quadtree_init (&sim->tree, QT_DEFAULT_THETA);
+  gravity_init ();
+  gravity_ctx_init (&sim->direct, GRAVITY_DOUBLE);
+  sim_set_softening (sim, GRAVITY_SOFT_SPLINE, SIM_DEFAULT_EPS);
+
+  sim->workers = calloc (sim->pool.thread_cnt, sizeof *sim->workers);
+  if (sim->workers == NULL)
+  {
+    fprintf (stderr, "sim: out of memory\n");
+    exit (1);
+  }
+
+  sim->collisions = COLLISION_BOUNCE;
+  spatial_grid_init (&sim->grid);
+  contact_solver_init (&sim->contacts);
+  sim->absorbed = NULL;
+  sim->absorbed_cap = 0;
+  memset (&sim->stats, 0, sizeof sim->stats);
+  memset (&sim->total, 0, sizeof sim->total);
+}
+
+/* Frees the resources held by SIM. */
+void sim_destroy (struct sim *sim)
+{
+  quadtree_destroy (&sim->tree);
+  gravity_ctx_destroy (&sim->direct);
+  thread_pool_destroy (&sim->pool);
+  free (sim->workers);
+  free (sim->block.level);
+  free (sim->block.prev_acc_x);
+  free (sim->block.prev_acc_y);
+  free (sim->block.active);
+  spatial_grid_destroy (&sim->grid);
+  contact_solver_destroy (&sim->contacts);
+  free (sim->absorbed);
+  body_store_destroy (&sim->bodies);
+}
+
+/* Replaces the bodies of SIM by STORE, which SIM takes over.  The
+   cached accelerations, block levels and contacts are dropped. */
+void sim_set_bodies (struct sim *sim, struct body_store *store)
+{
+  body_store_destroy (&sim->bodies);
+  sim->bodies = *store;
+  block_alloc (&sim->block, store->cap);
+  contact_solver_clear (&sim->contacts);
+  sim->acc_fresh = false;
+  sim->block.primed = false;
+}
+
+/* Adds a body to SIM at X, Y with velocity VX, VY, MASS, RADIUS and
+   COLOR, and returns its handle.  Body indices stay valid, but
+   pointers into the body arrays may move. */
+body_handle sim_add_body (struct sim *sim, double x, double y, double vx,
+                          double vy, double mass, double radius, Color color)
+{
+  struct body_store *b = &sim->bodies;
+  size_t cap = b->cap;
+  body_handle handle = body_store_add (b);
+  size_t i = b->cnt - 1;
+  b->pos_x[i] = x;
+  b->pos_y[i] = y;
+  b->vel_x[i] = vx;
+  b->vel_y[i] = vy;
+  b->mass[i] = mass;
+  b->radius[i] = radius;
+  b->color[i] = color;
+
+  if (b->cap != cap)
+    block_alloc (&sim->block, b->cap);
+  sim->acc_fresh = false;
+  sim->block.primed = false;
+  return handle;
+}
+
+/* Removes body I from SIM.  The last body takes index I. */
+void sim_remove_body (struct sim *sim, size_t i)
+{
+  body_store_remove (&sim->bodies, i);
+  sim->acc_fresh = false;
+  sim->block.primed = false;
+}
+
+/* Returns a monotonic wall clock reading in seconds. */
+double sim_clock (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Names of the force solvers, as on the command line. */
+static const char *const solver_names[SOLVER_CNT] =
+{
+  [SOLVER_DIRECT] = "direct",
+  [SOLVER_BARNES_HUT] = "barnes-hut",
+  [SOLVER_SYMMETRIC] = "symmetric",
+};
+
+/* Returns the name of SOLVER. */
+const char *sim_solver_name (enum force_solver solver)
+{
+  return (solver < SOLVER_CNT) ? solver_names[solver] : "?";
+}
+
+/* Returns the solver called NAME, or SOLVER_CNT if there is
+   none. */
+enum force_solver sim_solver_by_name (const char *name)
+{
+  enum force_solver solver;
+  for (solver = 0; solver < SOLVER_CNT; solver++)
+    if (strcmp (name, solver_names[solver]) == 0)
+      break;
+  return solver;
+}
+
+/* Names of the collision modes, as on the command line. */
+static const char *const collision_names[COLLISION_CNT] =
+{
+  [COLLISION_BOUNCE] = "bounce",
+  [COLLISION_MERGE] = "merge",
+  [COLLISION_NONE] = "none",
+};
+
+/* Returns the name of MODE. */
+const char *sim_collision_name (enum collision_mode mode)
+{
+  return (mode < COLLISION_CNT) ? collision_names[mode] : "?";
+}
+
+/* Returns the collision mode called NAME, or COLLISION_CNT if
+   there is none. */
+enum collision_mode sim_collision_by_name (const char *name)
+{
+  enum collision_mode mode;
+  for (mode = 0; mode < COLLISION_CNT; mode++)
+    if (strcmp (name, collision_names[mode]) == 0)
+      break;
+  return mode;
+}
+
+/* Softens every force path of SIM with law SOFTENING and length
+   EPS. */
+void sim_set_softening (struct sim *sim, enum gravity_softening softening,
+                        double eps)
+{
+  gravity_set_softening (&sim->direct, softening, eps);
+  quadtree_set_softening (&sim->tree, softening, eps);
+}
+
+/* Returns the softening law called NAME, or GRAVITY_SOFT_CNT if
+   there is none. */
+enum gravity_softening sim_softening_by_name (const char *name)
+{
+  enum gravity_softening softening;
+  for (softening = 0; softening < GRAVITY_SOFT_CNT; softening++)
+    if (strcmp (name, gravity_softening_name (softening)) == 0)
+      break;
+  return softening;
+}
+
+/* Integrator step functions and names, as on the command line. */
+static const struct
+{
+  const char *name;
+  void (*step) (struct sim *);
+}
+integrators[INTEGRATOR_CNT] =
+{
+  [INTEGRATOR_EULER] = { "euler", step_euler },
+  [INTEGRATOR_LEAPFROG] = { "leapfrog", step_leapfrog },
+  [INTEGRATOR_VERLET] = { "verlet", step_verlet },
+  [INTEGRATOR_YOSHIDA] = { "yoshida", step_yoshida },
+  [INTEGRATOR_BLOCK] = { "block", step_block },
+};
+
+/* Returns the name of INTEGRATOR. */
+const char *sim_integrator_name (enum integrator integrator)
+{
+  return (integrator < INTEGRATOR_CNT) ? integrators[integrator].name : "?";
+}
+
+/* Returns the integrator called NAME, or INTEGRATOR_CNT if there
+   is none. */
+enum integrator sim_integrator_by_name (const char *name)
+{
+  enum integrator integrator;
+  for (integrator = 0; integrator < INTEGRATOR_CNT; integrator++)
+    if (strcmp (name, integrators[integrator].name) == 0)
+      break;
+  return integrator;
+}
+
+/* Updates all bodies of SIM by a time step */
+void sim_step (struct sim *sim)
+{
+  PROFILE_BEGIN (PROFILE_STEP);
+  memset (&sim->stats, 0, sizeof sim->stats);
+  if (sim->integrator != INTEGRATOR_BLOCK)
+    sim->block.primed = false;
+  integrators[sim->integrator].step (sim);
+  sim->step_cnt++;
+  sim_stats_add (&sim->total, &sim->stats);
+  PROFILE_END (PROFILE_STEP);
+}
+
+/* Adds the counters of B to those of A */
+void sim_stats_add (struct sim_stats *a, const struct sim_stats *b)
+{
+#define ADD(F, NAME) a->F += b->F;
+  SIM_STATS (ADD)
+#undef ADD
+}
+
+/* Subtracts the counters of B from those of A */
+void sim_stats_sub (struct sim_stats *a, const struct sim_stats *b)
+{
+#define SUB(F, NAME) a->F -= b->F;
+  SIM_STATS (SUB)
+#undef SUB
+}
+
+/* The three phases every step is made of, one at a time, for
+   timing them apart.  None of them counts as a step, but each
+   leaves its own counters in SIM->stats. */
+
+/* Evaluates the accelerations of all bodies of SIM */
+void sim_forces (struct sim *sim)
+{
+  memset (&sim->stats, 0, sizeof sim->stats);
+  compute_forces (sim);
+}
+
+/* Finds and resolves the collisions between the bodies of SIM */
+void sim_collide (struct sim *sim)
+{
+  memset (&sim->stats, 0, sizeof sim->stats);
+  handle_collision (sim);
+}
+
+/* Kicks all bodies of SIM with their cached accelerations for H,
+   then drifts them for H */
+void sim_kick_drift (struct sim *sim, double h)
+{
+  kick (sim, h);
+  drift (sim, h);
+}
+
+/* Semi-implicit Euler: kick with the forces at the old positions,
+   then drift with the new velocities */
+static void step_euler (struct sim *sim)
+{
+  compute_forces (sim);
+  kick (sim, sim->dt);
+  handle_collision (sim);
+  drift (sim, sim->dt);
+  sim->acc_fresh = false;
+}
+
+/* Kick-drift-kick leapfrog */
+static void step_leapfrog (struct sim *sim)
+{
+  double dt = sim->dt;
+
+  if (!sim->acc_fresh)
+    compute_forces (sim);
+  kick (sim, dt / 2);
+  drift (sim, dt);
+  handle_collision (sim);
+  compute_forces (sim);
+  kick (sim, dt / 2);
+}
+
+/* Velocity Verlet.  The same scheme as leapfrog, but the opening
+   half kick and the drift run as one pass over the bodies:
+   x += (v + a dt / 2) dt */
+static void step_verlet (struct sim *sim)
+{
+  double dt = sim->dt;
+
+  if (!sim->acc_fresh)
+    compute_forces (sim);
+  sim->kick_dt = dt / 2;
+  sim->drift_dt = dt;
+  PROFILE_BEGIN (PROFILE_DRIFT);
+  thread_pool_run (&sim->pool, sim->bodies.cnt, kick_drift_task, sim);
+  PROFILE_END (PROFILE_DRIFT);
+  handle_collision (sim);
+  compute_forces (sim);
+  kick (sim, dt / 2);
+}
+
+/* Yoshida's 4th order triple jump: three leapfrog sub-steps of
+   W1 dt, W0 dt and W1 dt, with adjacent half kicks merged (the
+   same scheme as Forest and Ruth's) */
+static void step_yoshida (struct sim *sim)
+{
+  double cbrt2 = cbrt (2);
+  double w1 = 1 / (2 - cbrt2);
+  double w0 = -cbrt2 / (2 - cbrt2);
+  double dt = sim->dt;
+
+  if (!sim->acc_fresh)
+    compute_forces (sim);
+  kick (sim, w1 * dt / 2);
+  drift (sim, w1 * dt);
+  compute_forces (sim);
+  kick (sim, (w1 + w0) * dt / 2);
+  drift (sim, w0 * dt);
+  compute_forces (sim);
+  kick (sim, (w0 + w1) * dt / 2);
+  drift (sim, w1 * dt);
+  handle_collision (sim);
+  compute_forces (sim);
+  kick (sim, w1 * dt / 2);
+}
+
+/* (Re)allocates the per-body arrays of BLK for CNT bodies, exiting
+   on failure. */
+static void block_alloc (struct block_steps *blk, size_t cnt)
+{
+  size_t n = cnt ? cnt : 1;
+  free (blk->level);
+  free (blk->prev_acc_x);
+  free (blk->prev_acc_y);
+  free (blk->active);
+  blk->level = calloc (n, sizeof *blk->level);
+  blk->prev_acc_x = calloc (n, sizeof *blk->prev_acc_x);
+  blk->prev_acc_y = calloc (n, sizeof *blk->prev_acc_y);
+  blk->active = calloc (n, sizeof *blk->active);
+  if (blk->level == NULL || blk->prev_acc_x == NULL
+      || blk->prev_acc_y == NULL || blk->active == NULL)
+  {
+    fprintf (stderr, "sim: out of memory\n");
+    exit (1);
+  }
+}
+
+/* Kick-drift-kick leapfrog with block time steps.  Each tick
+   drifts every body, then evaluates and kicks the bodies whose
+   step ends there. */
+static void step_block (struct sim *sim)
+{
+  struct block_steps *blk = &sim->block;
+  struct body_store *bodies = &sim->bodies;
+  size_t cnt = bodies->cnt;
+  uint64_t ticks = (uint64_t) 1 << blk->max_level;
+
+  blk->active_sum = 0;
+  if (!blk->primed)
+  {
+    if (!sim->acc_fresh)
+    {
+      compute_forces (sim);
+      blk->active_sum += cnt;
+    }
+    for (size_t i = 0; i < cnt; i++)
+    {
+      blk->level[i] = 0;
+      blk->prev_acc_x[i] = bodies->acc_x[i];
+      blk->prev_acc_y[i] = bodies->acc_y[i];
+    }
+    blk->primed = true;
+  }
+
+  /* Every step starts at tick 0 */
+  block_select (sim, 0);
+  for (uint64_t k = 0; k < ticks; k++)
+  {
+    block_kick (sim, block_open_task);
+    drift (sim, sim->dt / ticks);
+    if (k + 1 == ticks)
+      handle_collision (sim);
+
+    block_select (sim, k + 1);
+    if (blk->active_cnt == 0)
+      continue;
+    block_forces (sim);
+    blk->tick = k + 1;
+    block_kick (sim, block_close_task);
+  }
+  sim->acc_fresh = true;
+
+  /* Mergers may have removed bodies */
+  memset (blk->level_cnt, 0, sizeof blk->level_cnt);
+  for (size_t i = 0; i < bodies->cnt; i++)
+    blk->level_cnt[blk->level[i]]++;
+}
+
+/* Collects in SIM's active list the bodies whose step starts or
+   ends at TICK of the current global step */
+static void block_select (struct sim *sim, uint64_t tick)
+{
+  struct block_steps *blk = &sim->block;
+  size_t cnt = sim->bodies.cnt;
+  int max = blk->max_level;
+
+  blk->active_cnt = 0;
+  for (size_t i = 0; i < cnt; i++)
+  {
+    uint64_t stride = (uint64_t) 1 << (max - blk->level[i]);
+    if (tick % stride == 0)
+      blk->active[blk->active_cnt++] = i;
+  }
+}
+
+/* Computes the acceleration of SIM's active bodies at their
+   current positions.  When every body is active this is a plain
+   force pass; otherwise the symmetric solver falls back to
+   direct rows, as its pairs cannot be restricted to a subset. */
+static void block_forces (struct sim *sim)
+{
+  struct block_steps *blk = &sim->block;
+  struct body_store *bodies = &sim->bodies;
+
+  blk->active_sum += blk->active_cnt;
+  if (blk->active_cnt == bodies->cnt)
+  {
+    compute_forces (sim);
+    return;
+  }
+
+  PROFILE_BEGIN (PROFILE_FORCES);
+  if (sim->solver == SOLVER_BARNES_HUT)
+    quadtree_build (&sim->tree, bodies);
+  else
+    gravity_prepare (&sim->direct, bodies);
+  clear_interactions (sim);
+  thread_pool_run (&sim->pool, blk->active_cnt, block_force_task, sim);
+
+  for (int w = 0; w < sim->pool.thread_cnt; w++)
+    sim->stats.interactions += sim->workers[w].interactions;
+  sim->stats.force_evals++;
+  PROFILE_END (PROFILE_FORCES);
+}
+
+/* Runs the block kick TASK over SIM's active bodies */
+static void block_kick (struct sim *sim, thread_pool_task *task)
+{
+  PROFILE_BEGIN (PROFILE_KICK);
+  thread_pool_run (&sim->pool, sim->block.active_cnt, task, sim);
+  PROFILE_END (PROFILE_KICK);
+}
+
+/* Computes the acceleration of active bodies BEGIN..END of SIM_
+   with the active solver */
+static void block_force_task (void *sim_, size_t begin, size_t end,
+                              int worker)
+{
+  struct sim *sim = sim_;
+  struct body_store *bodies = &sim->bodies;
+  const size_t *active = sim->block.active;
+  double *acc_x = bodies->acc_x;
+  double *acc_y = bodies->acc_y;
+  uint64_t interactions = 0;
+
+  for (size_t a = begin; a < end; a++)
+  {
+    size_t i = active[a];
+    if (sim->solver == SOLVER_BARNES_HUT)
+    {
+      acc_x[i] = 0;
+      acc_y[i] = 0;
+      interactions += quadtree_accel (&sim->tree, bodies, i,
+                                      &acc_x[i], &acc_y[i]);
+    }
+    else
+    {
+      gravity_accel (&sim->direct, i, i + 1, acc_x, acc_y);
+      interactions += bodies->cnt - 1;
+    }
+  }
+  sim->workers[worker].interactions = interactions;
+}
+
+/* Gives active bodies BEGIN..END of SIM_ the opening half kick of
+   their own step */
+static void block_open_task (void *sim_, size_t begin, size_t end,
+                             int worker)
+{
+  struct sim *sim = sim_;
+  struct body_store *bodies = &sim->bodies;
+  const struct block_steps *blk = &sim->block;
+
+  for (size_t a = begin; a < end; a++)
+  {
+    size_t i = blk->active[a];
+    double h = ldexp (sim->dt, -blk->level[i]) / 2;
+    bodies->vel_x[i] += bodies->acc_x[i] * h;
+    bodies->vel_y[i] += bodies->acc_y[i] * h;
+  }
+}
+
+/* Gives active bodies BEGIN..END of SIM_ the closing half kick of
+   their step, which ends at the current tick, and picks their
+   next level */
+static void block_close_task (void *sim_, size_t begin, size_t end,
+                              int worker)
+{
+  struct sim *sim = sim_;
+  struct body_store *bodies = &sim->bodies;
+  struct block_steps *blk = &sim->block;
+  uint64_t tick = blk->tick;
+  int max = blk->max_level;
+
+  for (size_t a = begin; a < end; a++)
+  {
+    size_t i = blk->active[a];
+    int old = blk->level[i];
+    double step = ldexp (sim->dt, -old);
+    double ax = bodies->acc_x[i];
+    double ay = bodies->acc_y[i];
+
+    bodies->vel_x[i] += ax * step / 2;
+    bodies->vel_y[i] += ay * step / 2;
+
+    /* Aarseth-style criterion: step <= ETA |a| / |j| */
+    double jerk = hypot (ax - blk->prev_acc_x[i], ay - blk->prev_acc_y[i]) / step;
+    double want = (jerk > 0) ? blk->eta * hypot (ax, ay) / jerk : sim->dt;
+    int level = 0;
+    while (level < max && ldexp (sim->dt, -level) > want)
+      level++;
+
+    /* Coarser levels only where their steps start */
+    while (level < old && tick % ((uint64_t) 1 << (max - level)) != 0)
+      level++;
+
+    blk->level[i] = level;
+    blk->prev_acc_x[i] = ax;
+    blk->prev_acc_y[i] = ay;
+  }
+}
+
+/* Computes the acceleration of every body of SIM at its current
+   position with the active solver */
+static void compute_forces (struct sim *sim)
+{
+  struct body_store *bodies = &sim->bodies;
+  size_t cnt = bodies->cnt;
+
+  PROFILE_BEGIN (PROFILE_FORCES);
+  clear_interactions (sim);
+  /* Newton's Law of Gravity: F = mm-/r² ⟹ a = m/r² */
+  if (sim->solver == SOLVER_SYMMETRIC)
+  {
+    gravity_prepare_pairs (&sim->direct, bodies, sim->pool.thread_cnt);
+    thread_pool_run (&sim->pool, gravity_pair_rows (&sim->direct),
+                     pairs_task, sim);
+    thread_pool_run (&sim->pool, cnt, reduce_task, sim);
+  }
+  else
+  {
+    if (sim->solver == SOLVER_BARNES_HUT)
+      quadtree_build (&sim->tree, bodies);
+    else
+      gravity_prepare (&sim->direct, bodies);
+    thread_pool_run (&sim->pool, cnt, force_task, sim);
+  }
+
+  /* Add up the per-worker counters in worker order */
+  for (int w = 0; w < sim->pool.thread_cnt; w++)
+    sim->stats.interactions += sim->workers[w].interactions;
+  sim->stats.force_evals++;
+  sim->acc_fresh = true;
+  PROFILE_END (PROFILE_FORCES);
+}
+
+/* Zeroes the interaction counters of SIM's workers.  A pool runs
+   short tasks on one thread only, so a pass must not count what
+   idle workers left from an earlier one. */
+static void clear_interactions (struct sim *sim)
+{
+  for (int w = 0; w < sim->pool.thread_cnt; w++)
+    sim->workers[w].interactions = 0;
+}
+
+/* Kicks the velocity of every body of SIM by sub-step H */
+static void kick (struct sim *sim, double h)
+{
+  PROFILE_BEGIN (PROFILE_KICK);
+  sim->kick_dt = h;
+  thread_pool_run (&sim->pool, sim->bodies.cnt, kick_task, sim);
+  PROFILE_END (PROFILE_KICK);
+}
+
+/* Drifts the position of every body of SIM by sub-step H.  The
+   accelerations no longer match the positions afterwards. */
+static void drift (struct sim *sim, double h)
+{
+  PROFILE_BEGIN (PROFILE_DRIFT);
+  sim->drift_dt = h;
+  thread_pool_run (&sim->pool, sim->bodies.cnt, drift_task, sim);
+  sim->acc_fresh = false;
+  PROFILE_END (PROFILE_DRIFT);
+}
+
+/* Computes the acceleration of bodies BEGIN..END of SIM_ with
+   the active solver.  Each body is summed by exactly one thread,
+   so results do not depend on the thread count. */
+static void force_task (void *sim_, size_t begin, size_t end, int worker)
+{
+  struct sim *sim = sim_;
+  struct body_store *bodies = &sim->bodies;
+  double *acc_x = bodies->acc_x;
+  double *acc_y = bodies->acc_y;
+  uint64_t interactions = 0;
+
+  if (sim->solver == SOLVER_DIRECT)
+  {
+    gravity_accel (&sim->direct, begin, end, acc_x, acc_y);
+    interactions = (uint64_t) (end - begin) * (bodies->cnt - 1);
+  }
+  else
+  {
+    for (size_t i = begin; i < end; i++)
+    {
+      acc_x[i] = 0;
+      acc_y[i] = 0;
+      interactions += quadtree_accel (&sim->tree, bodies, i,
+                                      &acc_x[i], &acc_y[i]);
+    }
+  }
+  sim->workers[worker].interactions = interactions;
+}
+
+/* Accumulates the pairs of folded row pairs BEGIN..END of SIM_
+   into the partial sums of WORKER */
+static void pairs_task (void *sim_, size_t begin, size_t end, int worker)
+{
+  struct sim *sim = sim_;
+  sim->workers[worker].interactions = gravity_pairs (&sim->direct, begin,
+                                                     end, worker);
+}
+
+/* Adds up the partial sums of bodies BEGIN..END of SIM_ into
+   their accelerations */
+static void reduce_task (void *sim_, size_t begin, size_t end, int worker)
+{
+  struct sim *sim = sim_;
+  gravity_reduce (&sim->direct, begin, end, sim->bodies.acc_x,
+                  sim->bodies.acc_y);
+}
+
+/* Kicks the velocity of bodies BEGIN..END of SIM_ by its kick
+   sub-step */
+static void kick_task (void *sim_, size_t begin, size_t end, int worker)
+{
+  struct sim *sim = sim_;
+  struct body_store *bodies = &sim->bodies;
+  double h = sim->kick_dt;
+  for (size_t i = begin; i < end; i++)
+  {
+    bodies->vel_x[i] += bodies->acc_x[i] * h;
+    bodies->vel_y[i] += bodies->acc_y[i] * h;
+  }
+}
+
+/* Drifts the position of bodies BEGIN..END of SIM_ by its drift
+   sub-step */
+static void drift_task (void *sim_, size_t begin, size_t end, int worker)
+{
+  struct sim *sim = sim_;
+  struct body_store *bodies = &sim->bodies;
+  double h = sim->drift_dt;
+  for (size_t i = begin; i < end; i++)
+  {
+    bodies->pos_x[i] += bodies->vel_x[i] * h;
+    bodies->pos_y[i] += bodies->vel_y[i] * h;
+  }
+}
+
+/* Kicks, then drifts bodies BEGIN..END of SIM_ in one pass */
+static void kick_drift_task (void *sim_, size_t begin, size_t end, int worker)
+{
+  struct sim *sim = sim_;
+  struct body_store *bodies = &sim->bodies;
+  double kh = sim->kick_dt;
+  double dh = sim->drift_dt;
+  for (size_t i = begin; i < end; i++)
+  {
+    bodies->vel_x[i] += bodies->acc_x[i] * kh;
+    bodies->vel_y[i] += bodies->acc_y[i] * kh;
+    bodies->pos_x[i] += bodies->vel_x[i] * dh;
+    bodies->pos_y[i] += bodies->vel_y[i] * dh;
+  }
+}
+
+/* Finds the touching pairs of SIM's bodies and resolves them by
+   its collision mode */
+static void handle_collision (struct sim *sim)
+{
+  struct body_store *bodies = &sim->bodies;
+  struct spatial_grid *grid = &sim->grid;
+  size_t cnt = bodies->cnt;
+  double *radius = bodies->radius;
+
+  /* Cached contacts only carry over between bouncing steps */
+  if (sim->collisions != COLLISION_BOUNCE)
+    contact_solver_clear (&sim->contacts);
+  if (cnt == 0 || sim->collisions == COLLISION_NONE) return;
+
+  PROFILE_BEGIN (PROFILE_COLLISIONS);
+  /* Broad phase: bodies can only touch if their grid cells are
+     neighbours, so only those pairs are tested below */
+  double max_radius = 0;
+  for (size_t i = 0; i < cnt; i++)
+    if (radius[i] > max_radius) max_radius = radius[i];
+  spatial_grid_build (grid, bodies->pos_x, bodies->pos_y, cnt,
+                      2 * max_radius + 1e-9);
+  sim->stats.candidates = spatial_grid_pairs (grid);
+
+  /* make them random: shuffle the order the pairs are resolved in,
+     bodies stay where they are */
+  struct rng rng = rng_stream (sim->seed, RNG_COLLISION_ORDER, sim->step_cnt);
+  for (size_t p = grid->pair_cnt; p > 1; p--)
+    {
+      size_t k = rng_below (&rng, p);
+      struct grid_pair t = grid->pairs[p - 1];
+      grid->pairs[p - 1] = grid->pairs[k];
+      grid->pairs[k] = t;
+    }
+
+  if (sim->collisions == COLLISION_MERGE)
+    merge_bodies (sim);
+  else
+    {
+      struct contact_solver *cs = &sim->contacts;
+      contact_solve (cs, bodies, grid->pairs, grid->pair_cnt);
+      sim->stats.contacts = cs->cnt;
+      for (size_t i = 0; i < cs->cnt; i++)
+        if (cs->contacts[i].impulse > 0)
+          sim->stats.resolved++;
+      sim->stats.separating = cs->cnt - sim->stats.resolved;
+      sim->stats.corrections = cs->corrections;
+      sim->stats.warm_started = cs->warm_started;
+      sim->stats.sweeps = cs->sweeps;
+      sim->stats.visits = cs->visits;
+    }
+  PROFILE_END (PROFILE_COLLISIONS);
+}
+
+/* Fuses the overlapping pairs among SIM's candidate pairs, in
+   their shuffled order, then compacts the bodies and their block
+   time step state.  A merged body takes the finer block level of
+   the two.  Cached accelerations of the survivors are left as
+   they are: every integrator evaluates forces between collisions
+   and the next kick. */
+static void merge_bodies (struct sim *sim)
+{
+  struct body_store *bodies = &sim->bodies;
+  struct spatial_grid *grid = &sim->grid;
+  size_t cnt = bodies->cnt;
+
+  if (sim->absorbed_cap < cnt)
+    {
+      free (sim->absorbed);
+      sim->absorbed = malloc (bodies->cap);
+      if (sim->absorbed == NULL)
+        {
+          fprintf (stderr, "sim: out of memory\n");
+          exit (1);
+        }
+      sim->absorbed_cap = bodies->cap;
+    }
+  unsigned char *absorbed = sim->absorbed;
+  memset (absorbed, 0, cnt);
+
+  size_t merged = 0;
+  for (size_t p = 0; p < grid->pair_cnt; p++)
+    {
+      size_t i = grid->pairs[p].a;
+      size_t j = grid->pairs[p].b;
+      if (absorbed[i] || absorbed[j])
+        continue;
+
+      /* Earlier mergers may have moved and grown either body */
+      double dx = bodies->pos_x[i] - bodies->pos_x[j];
+      double dy = bodies->pos_y[i] - bodies->pos_y[j];
+      double reach = bodies->radius[i] + bodies->radius[j];
+      if (dx * dx + dy * dy >= reach * reach)
+        continue;
+
+      sim->stats.contacts++;
+      if (bodies->mass[j] > bodies->mass[i])
+        {
+          size_t t = i;
+          i = j;
+          j = t;
+        }
+      merge_pair (bodies, i, j);
+      if (sim->block.level[j] > sim->block.level[i])
+        sim->block.level[i] = sim->block.level[j];
+      absorbed[j] = 1;
+      merged++;
+    }
+  if (merged == 0)
+    return;
+
+  /* Same pass as body_store_compact() over the block arrays */
+  struct block_steps *blk = &sim->block;
+  size_t to = 0;
+  for (size_t i = 0; i < cnt; i++)
+    if (!absorbed[i])
+      {
+        blk->level[to] = blk->level[i];
+        blk->prev_acc_x[to] = blk->prev_acc_x[i];
+        blk->prev_acc_y[to] = blk->prev_acc_y[i];
+        to++;
+      }
+  body_store_compact (bodies, absorbed);
+  sim->stats.merged = merged;
+}
+
+/* Merges body B of BODIES into body A, conserving mass and
+   momentum.  A moves to the centre of mass and its radius grows
+   to cover the area of both. */
+static void merge_pair (struct body_store *bodies, size_t a, size_t b)
+{
+  double mass = bodies->mass[a] + bodies->mass[b];
+  double wa = (mass > 0) ? bodies->mass[a] / mass : .5;
+  double wb = 1 - wa;
+
+  bodies->pos_x[a] = wa * bodies->pos_x[a] + wb * bodies->pos_x[b];
+  bodies->pos_y[a] = wa * bodies->pos_y[a] + wb * bodies->pos_y[b];
+  bodies->vel_x[a] = wa * bodies->vel_x[a] + wb * bodies->vel_x[b];
+  bodies->vel_y[a] = wa * bodies->vel_y[a] + wb * bodies->vel_y[b];
+  bodies->radius[a] = sqrt (bodies->radius[a] * bodies->radius[a]
+                            + bodies->radius[b] * bodies->radius[b]);
+  bodies->mass[a] = mass;
+}
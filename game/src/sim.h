@@ -0,0 +1,196 @@
+#ifndef SIM_H
+#define SIM_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "body.h"
+#include "quadtree.h"
+#include "gravity.h"
+#include "thread_pool.h"
+#include "spatial_grid.h"
+#include "contact.h"
+#include "ic.h"
+
+/* Simulation core.
+
+   Everything needed to advance the bodies lives in struct sim;
+   nothing in here opens a window or draws, so the same core runs
+   behind the interactive viewer and in headless batch runs. */
+
+/* Default softening length.  Bodies have a radius of 10, so
+   with the spline law only overlapping bodies feel softened
+   forces. */
+#define SIM_DEFAULT_EPS 10
+
+/* Force Solvers */
+enum force_solver
+{
+  SOLVER_DIRECT,        /* Exact O(N²) all-pairs sum */
+  SOLVER_BARNES_HUT,    /* O(N log N) quadtree approximation */
+  SOLVER_SYMMETRIC,     /* Exact all-pairs sum, each pair once */
+  SOLVER_CNT
+};
+
+/* Integrators
+
+   Every integrator but Euler is symplectic and reuses the forces
+   of the previous step's last evaluation for its first kick, so
+   the leapfrog and Verlet schemes cost one force evaluation per
+   step and Yoshida three.  Collisions are resolved after the last
+   drift of a step and before the closing force evaluation, so the
+   reused forces always match the positions they are applied at. */
+enum integrator
+{
+  INTEGRATOR_EULER,     /* Semi-implicit Euler, 1st order */
+  INTEGRATOR_LEAPFROG,  /* Kick-drift-kick leapfrog, 2nd order */
+  INTEGRATOR_VERLET,    /* Velocity Verlet with fused half kick and drift */
+  INTEGRATOR_YOSHIDA,   /* Yoshida / Forest-Ruth triple jump, 4th order */
+  INTEGRATOR_BLOCK,     /* Leapfrog with per-body block time steps */
+  INTEGRATOR_CNT
+};
+
+/* Collision Modes
+
+   Unless collisions are off, touching pairs are found by the
+   spatial grid after the last drift of a step.  Bouncing pairs go
+   to the contact solver (see contact.h), which carries their
+   impulses over from step to step.  Merging conserves mass and
+   momentum: the pair becomes one body at the centre of mass, with
+   the summed area and the handle and color of the heavier partner,
+   and the body arrays are compacted in place at the end of the
+   pass, so N shrinks as the system clumps.  An absorbed body drops
+   out of the rest of the pass, so a chain of touching bodies may
+   take a few steps to fuse. */
+enum collision_mode
+{
+  COLLISION_BOUNCE,     /* Partially elastic rebound */
+  COLLISION_MERGE,      /* Perfectly inelastic merger */
+  COLLISION_NONE,       /* Bodies pass through each other */
+  COLLISION_CNT
+};
+
+/* Block Time Steps
+
+   Body I steps by dt / 2^LEVEL[I], so one global step is made of
+   2^MAX_LEVEL ticks.  At every tick all bodies drift, but only
+   the bodies whose own step ends there get their forces
+   recomputed and are kicked, so the work follows the few bodies
+   in close encounters instead of the whole swarm.
+
+   After each force evaluation a body's level is chosen so that
+   its step is at most ETA |a| / |j|, with the jerk J estimated
+   from the change in acceleration since its previous evaluation.
+   A body may move to a finer level at any of its step ends but
+   to a coarser one only where that level's steps start, so every
+   body always sits on its level's grid of ticks. */
+#define BLOCK_MAX_LEVEL 12
+
+struct block_steps
+{
+  int max_level;              /* Finest level in use. */
+  double eta;                 /* Step accuracy parameter. */
+  bool primed;                /* PREV_ACC and LEVEL are valid. */
+  unsigned char *level;       /* Per body. */
+  double *prev_acc_x;         /* Acceleration at the body's last */
+  double *prev_acc_y;         /* force evaluation. */
+  size_t *active;             /* Bodies whose step ends at the tick. */
+  size_t active_cnt;
+  uint64_t tick;              /* Tick of the running pass. */
+  size_t level_cnt[BLOCK_MAX_LEVEL + 1];  /* Bodies per level. */
+  uint64_t active_sum;        /* Force evaluations of single bodies
+                                 in the last step. */
+};
+
+/* Event Counters
+
+   What one step did, for telling how the work of a step is made
+   up.  Force passes count in per-worker slots that are cleared
+   before the pass and added up once it is over, and collisions are
+   resolved on the stepping thread, so no counter is ever updated
+   atomically.  A direct pass over N bodies counts N(N-1)
+   interactions, a symmetric one N(N-1)/2. */
+#define SIM_STATS(X) \
+  X (interactions, "interactions")  /* Pair interactions. */ \
+  X (force_evals, "force passes")   /* Force evaluations. */ \
+  X (candidates, "candidates")      /* Broad-phase pairs. */ \
+  X (contacts, "contacts")          /* Overlapping pairs. */ \
+  X (resolved, "resolved")          /* Contacts left pushing. */ \
+  X (separating, "separating")      /* Contacts left at no impulse. */ \
+  X (corrections, "corrections")    /* Overlaps pushed apart. */ \
+  X (warm_started, "warm started")  /* Contacts kept from the step before. */ \
+  X (sweeps, "sweeps")              /* Contact solver sweeps. */ \
+  X (visits, "contact visits")      /* Contact updates in all sweeps. */ \
+  X (merged, "merged")              /* Bodies absorbed. */
+
+struct sim_stats
+{
+#define FIELD(F, NAME) uint64_t F;
+  SIM_STATS (FIELD)
+#undef FIELD
+};
+
+/* Per-worker counters, padded to a cache line so that workers
+   never write to the same line. */
+struct sim_worker
+{
+  uint64_t interactions;  /* Pair interactions in the last force pass. */
+  char pad[56];
+};
+
+/* Simulation. */
+struct sim
+{
+  struct body_store bodies;
+  double dt;                  /* Time step. */
+  uint64_t seed;              /* Seed of all random streams. */
+  uint64_t step_cnt;          /* Steps taken so far. */
+  enum integrator integrator;
+  bool acc_fresh;             /* Accelerations match the positions. */
+  double kick_dt;             /* Sub-step of the running kick pass. */
+  double drift_dt;            /* Sub-step of the running drift pass. */
+  struct block_steps block;
+
+  /* Force Solver State */
+  enum force_solver solver;
+  struct quadtree tree;
+  struct gravity_ctx direct;
+
+  /* Worker threads for the per-body passes */
+  struct thread_pool pool;
+  struct sim_worker *workers;
+
+  /* Collision Broad Phase State */
+  enum collision_mode collisions;
+  struct spatial_grid grid;
+  struct contact_solver contacts;
+  unsigned char *absorbed;    /* Per body, for merging */
+  size_t absorbed_cap;
+
+  struct sim_stats stats;     /* Of the last step. */
+  struct sim_stats total;     /* Of all steps so far. */
+};
+
+void sim_init (struct sim *, size_t cnt, enum ic_model, double dt,
+               uint64_t seed, int thread_cnt);
+void sim_destroy (struct sim *);
+void sim_step (struct sim *);
+void sim_forces (struct sim *);
+void sim_collide (struct sim *);
+void sim_kick_drift (struct sim *, double h);
+void sim_set_bodies (struct sim *, struct body_store *);
+body_handle sim_add_body (struct sim *, double x, double y, double vx,
+                          double vy, double mass, double radius, Color);
+void sim_remove_body (struct sim *, size_t i);
+double sim_clock (void);
+const char *sim_solver_name (enum force_solver);
+enum force_solver sim_solver_by_name (const char *);
+const char *sim_integrator_name (enum integrator);
+void sim_set_softening (struct sim *, enum gravity_softening, double eps);
+enum gravity_softening sim_softening_by_name (const char *);
+enum integrator sim_integrator_by_name (const char *);
+const char *sim_collision_name (enum collision_mode);
+enum collision_mode sim_collision_by_name (const char *);
+void sim_stats_add (struct sim_stats *, const struct sim_stats *);
+void sim_stats_sub (struct sim_stats *, const struct sim_stats *);
+
+#endif /* sim.h */
@@ -0,0 +1,114 @@
+#include "snapshot.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void *grow (void *p, size_t cnt, size_t size);
+
+/* Copies the drawable state of SIM into SNAP, growing SNAP's
+   arrays as needed. */
+void snapshot_capture (struct snapshot *snap, const struct sim *sim)
+{
+  const struct body_store *bodies = &sim->bodies;
+  size_t cnt = bodies->cnt;
+
+  if (snap->cap < cnt)
+    {
+      snap->pos_x = grow (snap->pos_x, cnt, sizeof *snap->pos_x);
+      snap->pos_y = grow (snap->pos_y, cnt, sizeof *snap->pos_y);
+      snap->radius = grow (snap->radius, cnt, sizeof *snap->radius);
+      snap->color = grow (snap->color, cnt, sizeof *snap->color);
+      snap->cap = cnt;
+    }
+  snap->cnt = cnt;
+
+  for (size_t i = 0; i < cnt; i++)
+    {
+      snap->pos_x[i] = (float) bodies->pos_x[i];
+      snap->pos_y[i] = (float) bodies->pos_y[i];
+      snap->radius[i] = (float) bodies->radius[i];
+    }
+  memcpy (snap->color, bodies->color, cnt * sizeof *snap->color);
+
+  snap->step_cnt = sim->step_cnt;
+  snap->dt = sim->dt;
+  snap->solver = sim->solver;
+  snap->integrator = sim->integrator;
+  snap->theta = sim->tree.theta;
+  snap->softening = sim->direct.softening;
+  snap->eps = sim->direct.eps;
+  snap->isa = gravity_get_isa ();
+  snap->precision = sim->direct.precision;
+  snap->thread_cnt = sim->pool.thread_cnt;
+  snap->collisions = sim->collisions;
+  snap->candidates = sim->stats.candidates;
+  snap->contacts = sim->stats.contacts;
+}
+
+/* Initializes BUF with three empty snapshots.  Nothing is fresh
+   until the first snapshot_buffer_publish(). */
+void snapshot_buffer_init (struct snapshot_buffer *buf)
+{
+  assert (buf != NULL);
+  memset (buf->slots, 0, sizeof buf->slots);
+  buf->back = 0;
+  buf->middle = 1;
+  buf->front = 2;
+}
+
+/* Frees the memory held by BUF. */
+void snapshot_buffer_destroy (struct snapshot_buffer *buf)
+{
+  assert (buf != NULL);
+  for (int i = 0; i < 3; i++)
+    {
+      struct snapshot *snap = &buf->slots[i];
+      free (snap->pos_x);
+      free (snap->pos_y);
+      free (snap->radius);
+      free (snap->color);
+    }
+  snapshot_buffer_init (buf);
+}
+
+/* Returns the snapshot the writer of BUF may fill.  It stays the
+   writer's until the next snapshot_buffer_publish(). */
+struct snapshot *snapshot_buffer_back (struct snapshot_buffer *buf)
+{
+  return &buf->slots[buf->back];
+}
+
+/* Publishes the back snapshot of BUF to the reader.  If the reader
+   has not picked up the previous one, that one is recycled. */
+void snapshot_buffer_publish (struct snapshot_buffer *buf)
+{
+  int old = __atomic_exchange_n (&buf->middle, buf->back | SNAPSHOT_FRESH,
+                                 __ATOMIC_ACQ_REL);
+  buf->back = old & ~SNAPSHOT_FRESH;
+}
+
+/* Returns the latest published snapshot of BUF.  It stays valid
+   for the reader until the next call. */
+const struct snapshot *snapshot_buffer_latest (struct snapshot_buffer *buf)
+{
+  if (__atomic_load_n (&buf->middle, __ATOMIC_ACQUIRE) & SNAPSHOT_FRESH)
+    {
+      int old = __atomic_exchange_n (&buf->middle, buf->front,
+                                     __ATOMIC_ACQ_REL);
+      buf->front = old & ~SNAPSHOT_FRESH;
+    }
+  return &buf->slots[buf->front];
+}
+
+/* Resizes P to CNT elements of SIZE bytes, exiting on failure. */
+static void *grow (void *p, size_t cnt, size_t size)
+{
+  p = realloc (p, cnt * size);
+  if (p == NULL)
+    {
+      fprintf (stderr, "snapshot: out of memory\n");
+      exit (1);
+    }
+  return p;
+}
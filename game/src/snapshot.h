@@ -0,0 +1,73 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+#include <stddef.h>
+#include <stdint.h>
+#include "raylib.h"
+#include "sim.h"
+
+/* Render snapshots.
+
+   A snapshot is a copy of everything the viewer draws: the bodies'
+   positions, radii and colours, plus the solver settings and
+   counters shown in the overlay.  Positions are stored as floats,
+   which is all the precision drawing needs and halves the copy.
+
+   The physics thread and the render thread exchange snapshots
+   through a lock-free triple buffer.  The writer fills its back
+   slot and swaps it with the shared middle slot; the reader swaps
+   the middle slot with its front slot whenever a newer one has
+   been published.  Each slot is owned by exactly one side at any
+   time, so neither side ever waits for the other, and the reader
+   always sees the latest complete snapshot. */
+
+/* Snapshot of the simulation. */
+struct snapshot
+{
+  size_t cnt;               /* Bodies. */
+  size_t cap;               /* Allocated bodies. */
+  float *pos_x;
+  float *pos_y;
+  float *radius;
+  Color *color;
+
+  uint64_t step_cnt;        /* Steps taken when captured. */
+  double dt;
+
+  /* Overlay */
+  enum force_solver solver;
+  enum integrator integrator;
+  double theta;
+  enum gravity_softening softening;
+  double eps;
+  enum gravity_isa isa;
+  enum gravity_precision precision;
+  int thread_cnt;
+  enum collision_mode collisions;
+  size_t candidates;        /* Collision pairs of the last step. */
+  size_t contacts;
+  double ratio;             /* Sim time / wall time. */
+  double rate;              /* Target steps per wall second. */
+};
+
+/* Triple buffer of snapshots.  BACK belongs to the writer and
+   FRONT to the reader; MIDDLE is shared and only accessed
+   atomically. */
+struct snapshot_buffer
+{
+  struct snapshot slots[3];
+  int back;
+  int front;
+  int middle;               /* Slot index, | SNAPSHOT_FRESH if unread. */
+};
+
+#define SNAPSHOT_FRESH 4
+
+void snapshot_capture (struct snapshot *, const struct sim *);
+
+void snapshot_buffer_init (struct snapshot_buffer *);
+void snapshot_buffer_destroy (struct snapshot_buffer *);
+struct snapshot *snapshot_buffer_back (struct snapshot_buffer *);
+void snapshot_buffer_publish (struct snapshot_buffer *);
+const struct snapshot *snapshot_buffer_latest (struct snapshot_buffer *);
+
+#endif /* snapshot.h */
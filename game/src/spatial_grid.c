@@ -0,0 +1,180 @@
+#include "spatial_grid.h"
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static void *grow (void *p, size_t cnt, size_t size);
+
+/* Returns the cell coordinate of position X for cells of inverse
+   size INV.  Non-finite positions all land in cell 0. */
+static inline int64_t cell_coord (double x, double inv)
+{
+  double c = floor (x * inv);
+  return (c > -1e15 && c < 1e15) ? (int64_t) c : 0;
+}
+
+/* Returns the bucket of cell CX, CY in a table of MASK + 1
+   buckets. */
+static inline uint32_t hash_cell (int64_t cx, int64_t cy, size_t mask)
+{
+  uint64_t h = (uint64_t) cx * 0x9E3779B185EBCA87ull
+               ^ (uint64_t) cy * 0xC2B2AE3D27D4EB4Full;
+  return (uint32_t) ((h ^ (h >> 29)) & mask);
+}
+
+/* Initializes GRID as empty. */
+void spatial_grid_init (struct spatial_grid *grid)
+{
+  assert (grid != NULL);
+  grid->cell_size = 0;
+  grid->cnt = 0;
+  grid->bucket_cnt = 0;
+  grid->bucket_start = NULL;
+  grid->sorted = NULL;
+  grid->cell_x = NULL;
+  grid->cell_y = NULL;
+  grid->bucket = NULL;
+  grid->body_cap = 0;
+  grid->pairs = NULL;
+  grid->pair_cnt = 0;
+  grid->pair_cap = 0;
+}
+
+/* Frees the memory held by GRID. */
+void spatial_grid_destroy (struct spatial_grid *grid)
+{
+  assert (grid != NULL);
+  free (grid->bucket_start);
+  free (grid->sorted);
+  free (grid->cell_x);
+  free (grid->cell_y);
+  free (grid->bucket);
+  free (grid->pairs);
+  spatial_grid_init (grid);
+}
+
+/* Rebuilds GRID from the CNT positions in POS_X and POS_Y using
+   square cells of width CELL_SIZE. */
+void spatial_grid_build (struct spatial_grid *grid, const double *pos_x,
+                         const double *pos_y, size_t cnt, double cell_size)
+{
+  assert (cell_size > 0);
+  assert (cnt < UINT32_MAX);
+
+  size_t bucket_cnt = 1024;
+  while (bucket_cnt < 2 * cnt)
+    bucket_cnt *= 2;
+
+  if (grid->bucket_cnt != bucket_cnt)
+    {
+      grid->bucket_start = grow (grid->bucket_start, bucket_cnt + 1,
+                                 sizeof *grid->bucket_start);
+      grid->bucket_cnt = bucket_cnt;
+    }
+  if (grid->body_cap < cnt)
+    {
+      grid->sorted = grow (grid->sorted, cnt, sizeof *grid->sorted);
+      grid->cell_x = grow (grid->cell_x, cnt, sizeof *grid->cell_x);
+      grid->cell_y = grow (grid->cell_y, cnt, sizeof *grid->cell_y);
+      grid->bucket = grow (grid->bucket, cnt, sizeof *grid->bucket);
+      grid->body_cap = cnt;
+    }
+  grid->cell_size = cell_size;
+  grid->cnt = cnt;
+
+  /* Counting sort of the bodies by bucket. */
+  double inv = 1.0 / cell_size;
+  size_t mask = bucket_cnt - 1;
+  uint32_t *start = grid->bucket_start;
+  for (size_t k = 0; k <= bucket_cnt; k++)
+    start[k] = 0;
+
+  for (size_t i = 0; i < cnt; i++)
+    {
+      int64_t cx = cell_coord (pos_x[i], inv);
+      int64_t cy = cell_coord (pos_y[i], inv);
+      uint32_t h = hash_cell (cx, cy, mask);
+      grid->cell_x[i] = cx;
+      grid->cell_y[i] = cy;
+      grid->bucket[i] = h;
+      start[h + 1]++;
+    }
+  for (size_t k = 0; k < bucket_cnt; k++)
+    start[k + 1] += start[k];
+
+  /* Place the bodies in increasing index order, advancing each
+     bucket's offset past its bodies, then shift the offsets back
+     so that bucket H spans START[H]..START[H + 1]. */
+  for (size_t i = 0; i < cnt; i++)
+    grid->sorted[start[grid->bucket[i]]++] = i;
+  for (size_t k = bucket_cnt; k > 0; k--)
+    start[k] = start[k - 1];
+  start[0] = 0;
+}
+
+/* Fills GRID->PAIRS with every pair of bodies A < B in the same or
+   in adjacent cells, ordered by A, and returns the number of
+   pairs. */
+size_t spatial_grid_pairs (struct spatial_grid *grid)
+{
+  size_t mask = grid->bucket_cnt - 1;
+  grid->pair_cnt = 0;
+
+  for (size_t a = 0; a < grid->cnt; a++)
+    {
+      int64_t cx = grid->cell_x[a];
+      int64_t cy = grid->cell_y[a];
+      uint32_t seen[9];
+      int seen_cnt = 0;
+
+      for (int oy = -1; oy <= 1; oy++)
+        for (int ox = -1; ox <= 1; ox++)
+          {
+            uint32_t h = hash_cell (cx + ox, cy + oy, mask);
+
+            /* Two neighbour cells may share a bucket. */
+            bool dup = false;
+            for (int k = 0; k < seen_cnt; k++)
+              dup |= (seen[k] == h);
+            if (dup)
+              continue;
+            seen[seen_cnt++] = h;
+
+            for (uint32_t k = grid->bucket_start[h];
+                 k < grid->bucket_start[h + 1]; k++)
+              {
+                uint32_t b = grid->sorted[k];
+                if (b <= a)
+                  continue;
+                if (llabs (grid->cell_x[b] - cx) > 1
+                    || llabs (grid->cell_y[b] - cy) > 1)
+                  continue;
+
+                if (grid->pair_cnt == grid->pair_cap)
+                  {
+                    size_t cap = grid->pair_cap ? grid->pair_cap * 2 : 1024;
+                    grid->pairs = grow (grid->pairs, cap, sizeof *grid->pairs);
+                    grid->pair_cap = cap;
+                  }
+                grid->pairs[grid->pair_cnt].a = a;
+                grid->pairs[grid->pair_cnt].b = b;
+                grid->pair_cnt++;
+              }
+          }
+    }
+  return grid->pair_cnt;
+}
+
+/* Resizes P to CNT elements of SIZE bytes, exiting on failure. */
+static void *grow (void *p, size_t cnt, size_t size)
+{
+  p = realloc (p, cnt * size);
+  if (p == NULL)
+    {
+      fprintf (stderr, "spatial_grid: out of memory\n");
+      exit (1);
+    }
+  return p;
+}
@@ -0,0 +1,55 @@
+#ifndef SPATIAL_GRID_H
+#define SPATIAL_GRID_H
+#include <stddef.h>
+#include <stdint.h>
+
+/* Uniform spatial hash grid.
+
+   Space is cut into square cells of a fixed size, which must be
+   at least the largest distance at which two bodies can touch
+   (the largest diameter).  Two overlapping bodies then always sit
+   in the same or in adjacent cells, so only the 3x3 block of
+   cells around a body has to be searched.
+
+   Cells are hashed into a table about twice the size of the body
+   count, so the grid does not need to know the extent of the
+   simulation.  spatial_grid_build() counting-sorts the bodies by
+   bucket, and spatial_grid_pairs() then lists every pair A < B
+   whose cells are neighbours.  Bodies in different cells that
+   happen to share a bucket are filtered out by comparing cell
+   coordinates, so the pair list only grows with the local
+   density, not with the table load. */
+
+/* Candidate pair, A < B. */
+struct grid_pair
+{
+  uint32_t a;
+  uint32_t b;
+};
+
+/* Spatial hash grid. */
+struct spatial_grid
+{
+  double cell_size;
+  size_t cnt;             /* Bodies in the grid. */
+
+  size_t bucket_cnt;      /* Power of two. */
+  uint32_t *bucket_start; /* BUCKET_CNT + 1 offsets into SORTED. */
+  uint32_t *sorted;       /* Body indices, grouped by bucket. */
+  int64_t *cell_x;        /* Cell coordinates of every body. */
+  int64_t *cell_y;
+  uint32_t *bucket;       /* Bucket of every body. */
+  size_t body_cap;
+
+  struct grid_pair *pairs;  /* Output of spatial_grid_pairs(). */
+  size_t pair_cnt;
+  size_t pair_cap;
+};
+
+void spatial_grid_init (struct spatial_grid *);
+void spatial_grid_destroy (struct spatial_grid *);
+void spatial_grid_build (struct spatial_grid *, const double *pos_x,
+                         const double *pos_y, size_t cnt, double cell_size);
+size_t spatial_grid_pairs (struct spatial_grid *);
+
+#endif /* spatial_grid.h */
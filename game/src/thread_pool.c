@@ -0,0 +1,170 @@
+#define _POSIX_C_SOURCE 200809L
+#include "thread_pool.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "profile.h"
+
+static void *worker_main (void *worker_);
+
+/* Returns the thread count to use when none is configured: the
+   NBODY_THREADS environment variable if set, otherwise the number
+   of online processors. */
+int thread_pool_default_size (void)
+{
+  const char *env = getenv ("NBODY_THREADS");
+  int cnt = (env != NULL) ? atoi (env) : 0;
+  if (cnt <= 0)
+    cnt = (int) sysconf (_SC_NPROCESSORS_ONLN);
+  if (cnt <= 0)
+    cnt = 1;
+  return (cnt > THREAD_POOL_MAX) ? THREAD_POOL_MAX : cnt;
+}
+
+/* Initializes POOL with THREAD_CNT threads in total, the calling
+   thread included, and starts the workers.  A THREAD_CNT of 0
+   or less selects thread_pool_default_size(). */
+void thread_pool_init (struct thread_pool *pool, int thread_cnt)
+{
+  assert (pool != NULL);
+  if (thread_cnt <= 0)
+    thread_cnt = thread_pool_default_size ();
+  if (thread_cnt > THREAD_POOL_MAX)
+    thread_cnt = THREAD_POOL_MAX;
+
+  pool->thread_cnt = thread_cnt;
+  pool->task = NULL;
+  pool->aux = NULL;
+  pool->cnt = 0;
+  pool->generation = 0;
+  pool->pending = 0;
+  pool->exiting = false;
+  pthread_mutex_init (&pool->lock, NULL);
+  pthread_cond_init (&pool->start, NULL);
+  pthread_cond_init (&pool->done, NULL);
+
+  pool->workers = calloc (thread_cnt, sizeof *pool->workers);
+  if (pool->workers == NULL)
+    {
+      fprintf (stderr, "thread_pool: out of memory\n");
+      exit (1);
+    }
+  for (int i = 1; i < thread_cnt; i++)
+    {
+      struct thread_pool_worker *w = &pool->workers[i];
+      w->pool = pool;
+      w->id = i;
+      if (pthread_create (&w->thread, NULL, worker_main, w) != 0)
+        {
+          fprintf (stderr, "thread_pool: cannot create worker %d\n", i);
+          exit (1);
+        }
+    }
+}
+
+/* Stops the workers of POOL and frees its resources. */
+void thread_pool_destroy (struct thread_pool *pool)
+{
+  assert (pool != NULL);
+  pthread_mutex_lock (&pool->lock);
+  pool->exiting = true;
+  pthread_cond_broadcast (&pool->start);
+  pthread_mutex_unlock (&pool->lock);
+
+  for (int i = 1; i < pool->thread_cnt; i++)
+    pthread_join (pool->workers[i].thread, NULL);
+
+  free (pool->workers);
+  pthread_cond_destroy (&pool->done);
+  pthread_cond_destroy (&pool->start);
+  pthread_mutex_destroy (&pool->lock);
+}
+
+/* Stores in *BEGIN and *END the slice of 0..CNT that WORKER of
+   THREAD_CNT threads processes. */
+void thread_pool_slice (size_t cnt, int thread_cnt, int worker,
+                        size_t *begin, size_t *end)
+{
+  size_t per = cnt / thread_cnt;
+  size_t extra = cnt % thread_cnt;
+  size_t w = worker;
+
+  *begin = w * per + (w < extra ? w : extra);
+  *end = *begin + per + (w < extra ? 1 : 0);
+}
+
+/* Runs TASK over indices 0..CNT on every thread of POOL and
+   returns when all slices are done.  Must be called from one
+   thread at a time, and calls from different threads must be
+   ordered, e.g. by creating the second thread after the first
+   call returns. */
+void thread_pool_run (struct thread_pool *pool, size_t cnt,
+                      thread_pool_task *task, void *aux)
+{
+  size_t begin, end;
+
+  if (pool->thread_cnt == 1 || cnt < (size_t) pool->thread_cnt)
+    {
+      PROFILE_BEGIN (PROFILE_TASK);
+      task (aux, 0, cnt, 0);
+      PROFILE_END (PROFILE_TASK);
+      return;
+    }
+
+  pthread_mutex_lock (&pool->lock);
+  pool->task = task;
+  pool->aux = aux;
+  pool->cnt = cnt;
+  pool->pending = pool->thread_cnt - 1;
+  pool->generation++;
+  pthread_cond_broadcast (&pool->start);
+  pthread_mutex_unlock (&pool->lock);
+
+  thread_pool_slice (cnt, pool->thread_cnt, 0, &begin, &end);
+  PROFILE_BEGIN (PROFILE_TASK);
+  task (aux, begin, end, 0);
+  PROFILE_END (PROFILE_TASK);
+
+  pthread_mutex_lock (&pool->lock);
+  while (pool->pending > 0)
+    pthread_cond_wait (&pool->done, &pool->lock);
+  pthread_mutex_unlock (&pool->lock);
+}
+
+/* Worker thread: waits for a job, runs its slice, repeats. */
+static void *worker_main (void *worker_)
+{
+  struct thread_pool_worker *w = worker_;
+  struct thread_pool *pool = w->pool;
+  unsigned seen = 0;
+  char name[32];
+
+  snprintf (name, sizeof name, "worker %d", w->id);
+  profile_thread_name (name);
+  pthread_mutex_lock (&pool->lock);
+  for (;;)
+    {
+      while (pool->generation == seen && !pool->exiting)
+        pthread_cond_wait (&pool->start, &pool->lock);
+      if (pool->exiting)
+        break;
+      seen = pool->generation;
+
+      thread_pool_task *task = pool->task;
+      void *aux = pool->aux;
+      size_t begin, end;
+      thread_pool_slice (pool->cnt, pool->thread_cnt, w->id, &begin, &end);
+      pthread_mutex_unlock (&pool->lock);
+
+      PROFILE_BEGIN (PROFILE_TASK);
+      task (aux, begin, end, w->id);
+      PROFILE_END (PROFILE_TASK);
+
+      pthread_mutex_lock (&pool->lock);
+      if (--pool->pending == 0)
+        pthread_cond_signal (&pool->done);
+    }
+  pthread_mutex_unlock (&pool->lock);
+  return NULL;
+}
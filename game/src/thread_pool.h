@@ -0,0 +1,63 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Persistent worker pool.
+
+   The worker threads are created once by thread_pool_init() and
+   sleep on a condition variable between jobs, so running a pass
+   costs a wake-up instead of a thread creation.
+
+   thread_pool_run() splits the index range 0..CNT into one
+   contiguous slice per thread, in order: slice K always goes to
+   worker K, and the calling thread works on slice 0 itself.
+   Because the split depends only on CNT and the thread count,
+   a task that keeps its partial results in per-worker slots and
+   combines them in worker order after thread_pool_run() returns
+   gets the same answer on every run. */
+
+/* Upper bound on the number of threads in a pool. */
+#define THREAD_POOL_MAX 256
+
+/* Processes indices BEGIN..END (exclusive) as worker WORKER. */
+typedef void thread_pool_task (void *aux, size_t begin, size_t end,
+                               int worker);
+
+/* Worker thread. */
+struct thread_pool_worker
+{
+  struct thread_pool *pool;
+  int id;                     /* Slice index, 1..THREAD_CNT - 1. */
+  pthread_t thread;
+};
+
+/* Thread pool. */
+struct thread_pool
+{
+  int thread_cnt;             /* Threads, including the caller. */
+  struct thread_pool_worker *workers;   /* By id; entry 0 is unused. */
+
+  pthread_mutex_t lock;
+  pthread_cond_t start;       /* Signaled when a job is posted. */
+  pthread_cond_t done;        /* Signaled when the last slice ends. */
+
+  /* Current job, protected by LOCK. */
+  thread_pool_task *task;
+  void *aux;
+  size_t cnt;
+  unsigned generation;        /* Incremented for every job. */
+  int pending;                /* Workers still running the job. */
+  bool exiting;
+};
+
+int thread_pool_default_size (void);
+void thread_pool_init (struct thread_pool *, int thread_cnt);
+void thread_pool_destroy (struct thread_pool *);
+void thread_pool_run (struct thread_pool *, size_t cnt,
+                      thread_pool_task *, void *aux);
+void thread_pool_slice (size_t cnt, int thread_cnt, int worker,
+                        size_t *begin, size_t *end);
+
+#endif /* thread_pool.h */
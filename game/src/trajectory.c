@@ -0,0 +1,279 @@
+#include "trajectory.h"
+#include <assert.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include "raylib.h"
+
+static void *writer_main (void *w_);
+static void chunk_add (struct trajectory_writer *w,
+                       const struct trajectory_frame *frame);
+static void chunk_flush (struct trajectory_writer *w);
+static void *grow (void *p, size_t cnt, size_t size);
+
+/* Opens PATH as a new trajectory file for the bodies of SIM and
+   starts the writer thread of W.  ENCODING is a combination of
+   TRAJ_DELTA and TRAJ_DEFLATE; a chunk holds at most CHUNK_FRAMES
+   frames.  Returns false, after printing why, if PATH cannot be
+   created. */
+bool trajectory_writer_open (struct trajectory_writer *w, const char *path,
+                             const struct sim *sim, int encoding,
+                             int chunk_frames)
+{
+  assert (w != NULL && chunk_frames > 0);
+  memset (w, 0, sizeof *w);
+  w->encoding = encoding;
+  w->chunk_frames = chunk_frames;
+
+  w->file = fopen (path, "wb");
+  if (w->file == NULL)
+    {
+      fprintf (stderr, "trajectory: cannot create %s\n", path);
+      return false;
+    }
+
+  struct trajectory_header hdr;
+  memset (&hdr, 0, sizeof hdr);
+  memcpy (hdr.magic, TRAJECTORY_MAGIC, sizeof hdr.magic);
+  hdr.version = TRAJECTORY_VERSION;
+  hdr.endian = TRAJECTORY_ENDIAN;
+  hdr.field_cnt = TRAJ_FIELD_CNT;
+  hdr.chunk_frames = chunk_frames;
+  hdr.dt = sim->dt;
+  hdr.seed = sim->seed;
+  if (fwrite (&hdr, sizeof hdr, 1, w->file) != 1)
+    {
+      fprintf (stderr, "trajectory: cannot write %s\n", path);
+      fclose (w->file);
+      return false;
+    }
+  w->stored_bytes = sizeof hdr;
+
+  w->infos = grow (NULL, chunk_frames, sizeof *w->infos);
+  pthread_mutex_init (&w->lock, NULL);
+  pthread_cond_init (&w->cond, NULL);
+  if (pthread_create (&w->thread, NULL, writer_main, w) != 0)
+    {
+      fprintf (stderr, "trajectory: cannot create writer thread\n");
+      exit (1);
+    }
+  return true;
+}
+
+/* Writes the frames still queued in W, closes its file and frees
+   its memory.  Returns false if any write failed. */
+bool trajectory_writer_close (struct trajectory_writer *w)
+{
+  pthread_mutex_lock (&w->lock);
+  w->exiting = true;
+  pthread_cond_broadcast (&w->cond);
+  pthread_mutex_unlock (&w->lock);
+  pthread_join (w->thread, NULL);
+
+  bool ok = !w->failed;
+  if (fclose (w->file) != 0)
+    ok = false;
+  if (!ok)
+    fprintf (stderr, "trajectory: write failed, file is incomplete\n");
+
+  pthread_cond_destroy (&w->cond);
+  pthread_mutex_destroy (&w->lock);
+  for (int i = 0; i < TRAJECTORY_QUEUE; i++)
+    free (w->queue[i].data);
+  free (w->prev);
+  free (w->raw);
+  free (w->infos);
+  return ok;
+}
+
+/* Queues the current positions and velocities of SIM to be
+   written by W.  If the queue is full, waits for a free slot if
+   WAIT, else drops the frame and returns false. */
+bool trajectory_writer_push (struct trajectory_writer *w,
+                             const struct sim *sim, bool wait)
+{
+  pthread_mutex_lock (&w->lock);
+  while (wait && w->len == TRAJECTORY_QUEUE)
+    pthread_cond_wait (&w->cond, &w->lock);
+  bool full = w->len == TRAJECTORY_QUEUE;
+  if (full)
+    w->dropped++;
+  size_t slot = (w->head + w->len) % TRAJECTORY_QUEUE;
+  pthread_mutex_unlock (&w->lock);
+  if (full)
+    return false;
+
+  /* The slot past the queue's end is ours until LEN covers it. */
+  struct trajectory_frame *frame = &w->queue[slot];
+  const struct body_store *b = &sim->bodies;
+  size_t cnt = b->cnt;
+  if (frame->cap < cnt)
+    {
+      frame->data = grow (frame->data, TRAJ_FIELD_CNT * cnt,
+                          sizeof *frame->data);
+      frame->cap = cnt;
+    }
+  frame->cnt = cnt;
+  frame->info.step = sim->step_cnt;
+  frame->info.time = sim->step_cnt * sim->dt;
+  memcpy (frame->data, b->pos_x, cnt * sizeof *frame->data);
+  memcpy (frame->data + cnt, b->pos_y, cnt * sizeof *frame->data);
+  memcpy (frame->data + 2 * cnt, b->vel_x, cnt * sizeof *frame->data);
+  memcpy (frame->data + 3 * cnt, b->vel_y, cnt * sizeof *frame->data);
+
+  pthread_mutex_lock (&w->lock);
+  w->len++;
+  pthread_cond_broadcast (&w->cond);
+  pthread_mutex_unlock (&w->lock);
+  return true;
+}
+
+/* Returns the encoding named NAME, or -1 if there is none. */
+int trajectory_encoding_by_name (const char *name)
+{
+  if (strcmp (name, "raw") == 0) return 0;
+  if (strcmp (name, "delta") == 0) return TRAJ_DELTA;
+  if (strcmp (name, "deflate") == 0) return TRAJ_DEFLATE;
+  if (strcmp (name, "delta-deflate") == 0) return TRAJ_DELTA | TRAJ_DEFLATE;
+  return -1;
+}
+
+/* Encodes the frames queued to W_ into chunks and writes them,
+   until asked to exit with an empty queue. */
+static void *writer_main (void *w_)
+{
+  struct trajectory_writer *w = w_;
+
+  pthread_mutex_lock (&w->lock);
+  for (;;)
+    {
+      while (w->len == 0 && !w->exiting)
+        pthread_cond_wait (&w->cond, &w->lock);
+      if (w->len == 0)
+        break;
+
+      /* The queue's first frame is ours until HEAD moves past it. */
+      struct trajectory_frame *frame = &w->queue[w->head];
+      pthread_mutex_unlock (&w->lock);
+      chunk_add (w, frame);
+      pthread_mutex_lock (&w->lock);
+
+      w->head = (w->head + 1) % TRAJECTORY_QUEUE;
+      w->len--;
+      pthread_cond_broadcast (&w->cond);
+    }
+  pthread_mutex_unlock (&w->lock);
+
+  chunk_flush (w);
+  return NULL;
+}
+
+/* Encodes FRAME onto the chunk of W, first writing out the chunk
+   if it is full or holds a different number of bodies. */
+static void chunk_add (struct trajectory_writer *w,
+                       const struct trajectory_frame *frame)
+{
+  size_t n = TRAJ_FIELD_CNT * frame->cnt;
+  size_t frame_size = n * sizeof (double);
+
+  /* CompressData() takes an int size. */
+  if (w->chunk_len > 0
+      && (w->chunk_len == w->chunk_frames || frame->cnt != w->chunk_cnt
+          || w->raw_size + frame_size > INT_MAX))
+    chunk_flush (w);
+
+  if (w->chunk_len == 0)
+    {
+      if (w->raw_cap < (size_t) w->chunk_frames * frame_size)
+        {
+          free (w->raw);
+          free (w->prev);
+          w->raw_cap = (size_t) w->chunk_frames * frame_size;
+          w->raw = grow (NULL, w->raw_cap, 1);
+          w->prev = grow (NULL, n, sizeof *w->prev);
+        }
+      w->chunk_cnt = frame->cnt;
+    }
+
+  /* XOR against the previous frame, then shuffle bytes. */
+  bool delta = (w->encoding & TRAJ_DELTA) && w->chunk_len > 0;
+  unsigned char *out = w->raw + w->raw_size;
+  for (size_t i = 0; i < n; i++)
+    {
+      uint64_t v;
+      memcpy (&v, &frame->data[i], sizeof v);
+      if (delta)
+        {
+          uint64_t p;
+          memcpy (&p, &w->prev[i], sizeof p);
+          v ^= p;
+        }
+      for (int b = 0; b < 8; b++)
+        out[b * n + i] = (unsigned char) (v >> (8 * b));
+    }
+  memcpy (w->prev, frame->data, frame_size);
+
+  w->raw_size += frame_size;
+  w->infos[w->chunk_len++] = frame->info;
+}
+
+/* Writes out the chunk of W, if it holds any frames. */
+static void chunk_flush (struct trajectory_writer *w)
+{
+  if (w->chunk_len == 0)
+    return;
+
+  struct trajectory_chunk chunk;
+  memset (&chunk, 0, sizeof chunk);
+  memcpy (chunk.magic, "CHNK", sizeof chunk.magic);
+  chunk.frame_cnt = w->chunk_len;
+  chunk.cnt = w->chunk_cnt;
+  chunk.flags = w->encoding & TRAJ_DELTA;
+  chunk.raw_size = w->raw_size;
+
+  const unsigned char *payload = w->raw;
+  unsigned char *packed = NULL;
+  int packed_size = 0;
+  if ((w->encoding & TRAJ_DEFLATE) && w->raw_size <= INT_MAX)
+    {
+      packed = CompressData (w->raw, (int) w->raw_size, &packed_size);
+      if (packed != NULL && packed_size > 0
+          && (size_t) packed_size < w->raw_size)
+        {
+          payload = packed;
+          chunk.flags |= TRAJ_DEFLATE;
+        }
+    }
+  chunk.stored_size = (chunk.flags & TRAJ_DEFLATE) ? (size_t) packed_size
+                                                    : w->raw_size;
+
+  if (!w->failed)
+    {
+      size_t info_size = w->chunk_len * sizeof *w->infos;
+      if (fwrite (&chunk, sizeof chunk, 1, w->file) != 1
+          || fwrite (w->infos, info_size, 1, w->file) != 1
+          || fwrite (payload, chunk.stored_size, 1, w->file) != 1)
+        w->failed = true;
+      w->frames += w->chunk_len;
+      w->raw_bytes += w->raw_size;
+      w->stored_bytes += sizeof chunk + info_size + chunk.stored_size;
+    }
+  if (packed != NULL)
+    MemFree (packed);
+
+  w->chunk_len = 0;
+  w->raw_size = 0;
+}
+
+/* Reallocates P to CNT elements of SIZE bytes, exiting on
+   failure. */
+static void *grow (void *p, size_t cnt, size_t size)
+{
+  p = realloc (p, (cnt ? cnt : 1) * size);
+  if (p == NULL)
+    {
+      fprintf (stderr, "trajectory: out of memory\n");
+      exit (1);
+    }
+  return p;
+}
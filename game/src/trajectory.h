@@ -0,0 +1,141 @@
+#ifndef TRAJECTORY_H
+#define TRAJECTORY_H
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "sim.h"
+
+/* Trajectory files.
+
+   A trajectory file records the positions and velocities of every
+   body at chosen steps, for analysis after the run.  It is a
+   header followed by chunks, appended as the run goes on, so a
+   file cut short by a crash is still readable up to its last
+   complete chunk.
+
+   A chunk holds up to CHUNK_FRAMES frames with the same body
+   count, stored as one payload:
+
+     - With TRAJ_DELTA, every frame but the chunk's first is stored
+       as the bitwise XOR of its doubles with the previous frame's.
+       Bodies move little between frames, so most high bytes become
+       zero.  XOR is exact, so decoding gives back the same bits.
+
+     - Each frame's doubles are then byte-shuffled: the least
+       significant byte of every value, then the next byte of every
+       value, and so on.  This groups the zero bytes delta encoding
+       leaves into long runs.
+
+     - With TRAJ_DEFLATE, the payload is compressed with raylib's
+       CompressData() (raw DEFLATE).  A chunk that would not shrink
+       is stored as is, without the flag.
+
+   Every chunk starts over from a plain frame, so a reader can
+   start at any chunk.
+
+   Frames are handed over through a bounded queue to a writer
+   thread, which encodes, compresses and writes them.  The step
+   loop only copies the state into a free queue slot.  If the
+   writer falls behind and the queue is full, the caller chooses
+   between waiting for a slot, for runs that need every frame, and
+   dropping the frame, counted, so a real-time run never stalls. */
+
+#define TRAJECTORY_MAGIC "NBODYTRJ"
+#define TRAJECTORY_VERSION 1
+#define TRAJECTORY_ENDIAN 0x01020304u
+#define TRAJECTORY_QUEUE 8          /* Frames in flight. */
+#define TRAJ_FIELD_CNT 4            /* pos_x, pos_y, vel_x, vel_y. */
+
+/* Encodings, also chunk flags. */
+#define TRAJ_DELTA 1
+#define TRAJ_DEFLATE 2
+
+/* File header. */
+struct trajectory_header
+{
+  char magic[8];              /* TRAJECTORY_MAGIC, not terminated. */
+  uint32_t version;
+  uint32_t endian;            /* TRAJECTORY_ENDIAN as written. */
+  uint32_t field_cnt;         /* TRAJ_FIELD_CNT doubles per body. */
+  uint32_t chunk_frames;      /* Most frames per chunk. */
+  double dt;
+  uint64_t seed;
+};
+
+/* Chunk header.  It is followed by FRAME_CNT trajectory_frame_info
+   and then STORED_SIZE bytes of payload, which decode to RAW_SIZE
+   bytes: for each frame, FIELD_CNT arrays of CNT doubles, each
+   field in order, shuffled as described above. */
+struct trajectory_chunk
+{
+  char magic[4];              /* "CHNK". */
+  uint32_t frame_cnt;
+  uint64_t cnt;               /* Bodies in every frame. */
+  uint32_t flags;             /* TRAJ_DELTA, TRAJ_DEFLATE. */
+  uint32_t reserved;
+  uint64_t raw_size;
+  uint64_t stored_size;
+};
+
+struct trajectory_frame_info
+{
+  uint64_t step;
+  double time;
+};
+
+/* Queued frame: TRAJ_FIELD_CNT arrays of CNT doubles. */
+struct trajectory_frame
+{
+  struct trajectory_frame_info info;
+  size_t cnt;
+  size_t cap;
+  double *data;
+};
+
+/* Background trajectory writer. */
+struct trajectory_writer
+{
+  FILE *file;
+  int encoding;               /* TRAJ_DELTA | TRAJ_DEFLATE. */
+  int chunk_frames;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;        /* Signaled when LEN or EXITING
+                                 change. */
+
+  /* Ring of queued frames.  Protected by LOCK, except that the
+     slot after the last queued one belongs to the submitter and
+     the first queued one to the writer thread. */
+  struct trajectory_frame queue[TRAJECTORY_QUEUE];
+  size_t head;
+  size_t len;
+  bool exiting;
+  uint64_t dropped;           /* Frames lost to a full queue. */
+
+  /* Writer thread only. */
+  double *prev;               /* Previous frame of the chunk. */
+  unsigned char *raw;         /* Encoded frames of the chunk. */
+  size_t raw_size;
+  size_t raw_cap;
+  struct trajectory_frame_info *infos;
+  int chunk_len;              /* Frames in the chunk. */
+  size_t chunk_cnt;           /* Bodies per frame of the chunk. */
+  bool failed;                /* A write failed; drop the rest. */
+
+  /* Totals, valid after trajectory_writer_close(). */
+  uint64_t frames;
+  uint64_t raw_bytes;
+  uint64_t stored_bytes;
+};
+
+bool trajectory_writer_open (struct trajectory_writer *, const char *path,
+                             const struct sim *, int encoding,
+                             int chunk_frames);
+bool trajectory_writer_close (struct trajectory_writer *);
+bool trajectory_writer_push (struct trajectory_writer *, const struct sim *,
+                             bool wait);
+int trajectory_encoding_by_name (const char *);
+
+#endif /* trajectory.h */